@@ -0,0 +1,6450 @@
+/*
+    libtimedwriter : the workloads, timing and reporting behind timed-writer
+
+    Copyright (C) 2022 Brendon Caligari <caligari@cypraea.co.uk>
+
+    License: GNU Affero General Public License
+        https://www.gnu.org/licenses/agpl-3.0.en.html
+
+    The public probe API is declared in timedwriter.h and implemented at
+    the end of this file; the rest is shared with the CLI through
+    timedwriter-internal.h.
+*/
+
+#include "timedwriter-internal.h"
+
+
+double now_mono(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000);
+}
+
+
+void hist_init(struct lat_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+
+static int hist_index(unsigned long long usec)
+{
+    int msb;
+    int idx;
+
+    if (usec < (1ULL << HIST_SUB_BITS))
+        return (int) usec;
+    msb = 63 - __builtin_clzll(usec);
+    idx = ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+        (int) ((usec >> (msb - HIST_SUB_BITS)) & ((1ULL << HIST_SUB_BITS) - 1));
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+
+/* upper bound of a bucket in seconds */
+static double hist_bucket_limit(int idx)
+{
+    int shift, mant;
+
+    if (idx < (1 << HIST_SUB_BITS))
+        return (double) (idx + 1) / 1000000;
+    shift = (idx >> HIST_SUB_BITS) - 1;
+    mant = idx & ((1 << HIST_SUB_BITS) - 1);
+    return (double) ((unsigned long long) ((1 << HIST_SUB_BITS) + mant + 1) << shift) / 1000000;
+}
+
+
+void hist_record(struct lat_hist *h, double seconds)
+{
+    if (seconds < 0)
+        seconds = 0;
+    if ((h->count == 0) || (seconds < h->min))
+        h->min = seconds;
+    if (seconds > h->max)
+        h->max = seconds;
+    h->count++;
+    h->sum += seconds;
+    h->bucket[hist_index((unsigned long long) (seconds * 1000000))]++;
+}
+
+
+double hist_percentile(const struct lat_hist *h, double pct)
+{
+    unsigned long target, seen = 0;
+    double limit;
+
+    if (h->count == 0)
+        return 0;
+    target = (unsigned long) ((pct / 100) * h->count + 0.999999);
+    if (target == 0)
+        target = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen >= target) {
+            limit = hist_bucket_limit(i);
+            return limit < h->max ? limit : h->max;
+        }
+    }
+    return h->max;
+}
+
+
+int hist_format(char *buf, size_t size, const char *label, const struct lat_hist *h)
+{
+    if (h->count == 0)
+        return snprintf(buf, size, "%-18s: no samples\n", label);
+    return snprintf(buf, size, "%-18s: n=%lu min=%.3lf avg=%.3lf p50=%.3lf p90=%.3lf p99=%.3lf max=%.3lf ms\n",
+        label,
+        h->count,
+        h->min * 1000,
+        h->sum / h->count * 1000,
+        hist_percentile(h, 50) * 1000,
+        hist_percentile(h, 90) * 1000,
+        hist_percentile(h, 99) * 1000,
+        h->max * 1000);
+}
+
+
+void hist_print(const char *label, const struct lat_hist *h)
+{
+    char line[HIST_LINE_MAX];
+
+    hist_format(line, sizeof(line), label, h);
+    fputs(line, stdout);
+}
+
+
+void hist_merge(struct lat_hist *dst, const struct lat_hist *src)
+{
+    if (src->count == 0)
+        return;
+    if ((dst->count == 0) || (src->min < dst->min))
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dst->bucket[i] += src->bucket[i];
+}
+
+
+/*
+    one-line run events (fsync() and write() failures, brownouts, flight
+    recorder dumps) go to stream, or to the status line of a -D dashboard
+    while it owns the terminal, rather than scribbling over its frame
+*/
+static pthread_mutex_t notice_lock = PTHREAD_MUTEX_INITIALIZER;
+static char notice_line[NOTICE_MAX];
+static int notice_held;                     /* a dashboard shows notice_line */
+
+
+void run_notice(FILE *stream, const char *fmt, ...)
+{
+    va_list ap;
+
+    pthread_mutex_lock(&notice_lock);
+    va_start(ap, fmt);
+    if (notice_held)
+        vsnprintf(notice_line, sizeof(notice_line), fmt, ap);
+    else {
+        vfprintf(stream, fmt, ap);
+        fputc('\n', stream);
+    }
+    va_end(ap);
+    pthread_mutex_unlock(&notice_lock);
+}
+
+
+/* CRC32C (Castagnoli), bytewise table */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    static uint32_t table[256];
+    const unsigned char *p = buf;
+
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+
+/*
+    -M NAME: live counters and the latency histogram of a run are kept in
+    the POSIX shared memory object /timed-writer.NAME so a monitor can read
+    them without parsing output.  A single writer updates them under a
+    seqlock, readers retry until they see the same even sequence on both
+    sides of their copy.
+*/
+struct live_metrics {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    int32_t blocksize;
+    atomic_uint seq;
+    double started;                         /* CLOCK_REALTIME */
+    double updated;
+    unsigned long iterations;
+    unsigned long long bytes;
+    unsigned long failures;
+    unsigned long failure_streak;
+    double last_latency;
+    struct lat_hist hist;
+    struct lat_hist lock_hist;              /* -L only */
+};
+
+
+static void live_metrics_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "/timed-writer.%s", name);
+}
+
+
+static double now_real(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000);
+}
+
+
+/* the pid a segment names is still running, signalling it or not */
+static int live_owner_alive(pid_t pid)
+{
+    return (pid > 0) && ((kill(pid, 0) == 0) || (errno == EPERM));
+}
+
+
+/* 0 if an existing /timed-writer.NAME was left by a run that is gone and has been removed */
+static int live_metrics_reclaim(const char *path)
+{
+    struct live_metrics *lm;
+    int fd, stale;
+
+    if ((fd = shm_open(path, O_RDONLY, 0)) == -1)
+        return -1;
+    lm = mmap(NULL, sizeof(*lm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (lm == MAP_FAILED)
+        return -1;
+    stale = (lm->magic == LIVE_MAGIC) && (lm->version == LIVE_VERSION) && !live_owner_alive(lm->pid);
+    munmap(lm, sizeof(*lm));
+    if (!stale) {
+        errno = EEXIST;
+        return -1;
+    }
+    return shm_unlink(path);
+}
+
+
+struct live_metrics *live_metrics_create(const char *name, int blocksize)
+{
+    struct live_metrics *lm;
+    char path[NAME_MAX];
+    int fd;
+
+    // unnamed metrics stay private to the process, for -D without -M
+    if (name == NULL)
+        lm = mmap(NULL, sizeof(*lm), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    else {
+        live_metrics_path(path, sizeof(path), name);
+        // never share NAME with a live run, take over one whose writer died
+        if (((fd = shm_open(path, O_RDWR|O_CREAT|O_EXCL, (mode_t) 0644)) == -1) &&
+            ((errno != EEXIST) || (live_metrics_reclaim(path) == -1) ||
+             ((fd = shm_open(path, O_RDWR|O_CREAT|O_EXCL, (mode_t) 0644)) == -1)))
+            return NULL;
+        if (ftruncate(fd, sizeof(*lm)) == -1) {
+            close(fd);
+            return NULL;
+        }
+        lm = mmap(NULL, sizeof(*lm), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (lm == MAP_FAILED)
+        return NULL;
+    memset(lm, 0, sizeof(*lm));
+    lm->version = LIVE_VERSION;
+    lm->pid = (int32_t) getpid();
+    lm->blocksize = blocksize;
+    lm->started = lm->updated = now_real();
+    hist_init(&lm->hist);
+    hist_init(&lm->lock_hist);
+    atomic_store_explicit(&lm->seq, 0, memory_order_release);
+    lm->magic = LIVE_MAGIC;
+    return lm;
+}
+
+
+/* one completed iteration, written inside the seqlock; lock_wait < 0 if no lock was taken */
+void live_metrics_record(struct live_metrics *lm, double latency, size_t bytes, int ok, double lock_wait)
+{
+    unsigned int seq = atomic_load_explicit(&lm->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&lm->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    lm->iterations++;
+    lm->bytes += bytes;
+    lm->updated = now_real();
+    if (ok) {
+        lm->failure_streak = 0;
+        lm->last_latency = latency;
+        hist_record(&lm->hist, latency);
+    } else {
+        lm->failures++;
+        lm->failure_streak++;
+    }
+    if (lock_wait >= 0)
+        hist_record(&lm->lock_hist, lock_wait);
+    atomic_store_explicit(&lm->seq, seq + 2, memory_order_release);
+}
+
+
+/* consistent copy of lm, 0 on success */
+int live_metrics_snapshot(const struct live_metrics *lm, struct live_metrics *copy)
+{
+    unsigned int before, after;
+
+    for (int tries = 0; tries < 1000; tries++) {
+        before = atomic_load_explicit(&lm->seq, memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(copy, (const void *) lm, sizeof(*copy));
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&lm->seq, memory_order_relaxed);
+        if (before == after)
+            return 0;
+    }
+    return -1;
+}
+
+
+void live_metrics_destroy(struct live_metrics *lm, const char *name)
+{
+    char path[NAME_MAX];
+
+    munmap(lm, sizeof(*lm));
+    if (name) {
+        live_metrics_path(path, sizeof(path), name);
+        shm_unlink(path);
+    }
+}
+
+
+/* monitor subcommand: attach read-only to a running instance and print its state */
+int live_monitor(const char *name, int interval, int count)
+{
+    struct live_metrics *lm, snap;
+    char path[NAME_MAX];
+    int fd;
+
+    live_metrics_path(path, sizeof(path), name);
+    if ((fd = shm_open(path, O_RDONLY, 0)) == -1) {
+        fprintf(stderr, "Unable to attach to %s : shm_open() returned %d (%s)\n",
+            path,
+            errno,
+            strerror(errno));
+        return 1;
+    }
+    lm = mmap(NULL, sizeof(*lm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (lm == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %s : %s\n", path, strerror(errno));
+        return 1;
+    }
+    if ((lm->magic != LIVE_MAGIC) || (lm->version != LIVE_VERSION)) {
+        fprintf(stderr, "%s is not a timed-writer version %d metrics segment\n", path, LIVE_VERSION);
+        munmap(lm, sizeof(*lm));
+        return 1;
+    }
+
+    printf("%-8s %10s %14s %8s %7s %10s %10s %10s %10s %8s\n",
+        "pid", "iterations", "bytes", "failures", "streak", "last ms", "p50 ms", "p99 ms", "max ms", "age s");
+    for (int n = 0; (count == 0) || (n < count); n++) {
+        if (n)
+            sleep(interval);
+        if (live_metrics_snapshot(lm, &snap) == -1) {
+            fprintf(stderr, "Writer kept %s busy, skipping a sample\n", path);
+            continue;
+        }
+        printf("%-8d %10lu %14llu %8lu %7lu %10.3lf %10.3lf %10.3lf %10.3lf %8.1lf\n",
+            snap.pid,
+            snap.iterations,
+            snap.bytes,
+            snap.failures,
+            snap.failure_streak,
+            snap.last_latency * 1000,
+            hist_percentile(&snap.hist, 50) * 1000,
+            hist_percentile(&snap.hist, 99) * 1000,
+            snap.hist.max * 1000,
+            now_real() - snap.updated);
+        fflush(stdout);
+        if (!live_owner_alive(snap.pid)) {
+            fprintf(stderr, "Writer %d is gone, %s was left behind by a run that didn't finish\n",
+                snap.pid,
+                path);
+            munmap(lm, sizeof(*lm));
+            return 1;
+        }
+    }
+
+    munmap(lm, sizeof(*lm));
+    return 0;
+}
+
+
+/* fill the start of buf with the iteration's "%d\n" and return the write() size */
+size_t payload_header(void *buf, int iter, int blocksize)
+{
+    char str_buf[BS_DEF];
+    size_t str_len;
+
+    sprintf(str_buf, "%d\n", iter);
+    str_len = strlen(str_buf);
+    memcpy(buf, str_buf, str_len);
+    return blocksize ? (size_t) blocksize : str_len;
+}
+
+
+/* words of a regenerated payload depend on the sequence so no two blocks match */
+#define PAYLOAD_WORD(iter, i)   (((uint64_t) (iter) * 0x9E3779B97F4A7C15ULL) ^ (uint64_t) (i))
+
+
+/* -p regen: rewrite the whole block with ordinary stores, then patch the header */
+void payload_fill_scalar(void *buf, size_t len, int iter)
+{
+    uint64_t *w = buf;
+    size_t words = len / sizeof(*w);
+
+    for (size_t i = 0; i < words; i++)
+        w[i] = PAYLOAD_WORD(iter, i);
+    memset((char *) buf + words * sizeof(*w), '\r', len - words * sizeof(*w));
+}
+
+
+/*
+    -p regen-nt: same bytes as payload_fill_scalar() but written with
+    non-temporal stores that bypass the cache hierarchy, so regenerating a
+    large block does not evict the writer's working set
+*/
+void payload_fill_nt(void *buf, size_t len, int iter)
+{
+#if defined(__SSE2__)
+    uint64_t *w = buf;
+    size_t words = len / sizeof(*w);
+    size_t i = 0;
+
+    // scalar up to the first 16 byte boundary
+    for (; (i < words) && ((uintptr_t) &w[i] & 15); i++)
+        w[i] = PAYLOAD_WORD(iter, i);
+    for (; i + 2 <= words; i += 2)
+        _mm_stream_si128((__m128i *) &w[i],
+            _mm_set_epi64x((long long) PAYLOAD_WORD(iter, i + 1), (long long) PAYLOAD_WORD(iter, i)));
+    for (; i < words; i++)
+        w[i] = PAYLOAD_WORD(iter, i);
+    _mm_sfence();
+    memset((char *) buf + words * sizeof(*w), '\r', len - words * sizeof(*w));
+#else
+    payload_fill_scalar(buf, len, iter);
+#endif
+}
+
+
+/* header of a regenerated block, one streamed 16 byte store when aligned */
+size_t payload_header_nt(void *buf, int iter, int blocksize)
+{
+#if defined(__SSE2__)
+    char str_buf[16] __attribute__((aligned(16)));
+    int str_len;
+
+    if ((blocksize < 16) || ((uintptr_t) buf & 15))
+        return payload_header(buf, iter, blocksize);
+    memcpy(str_buf, buf, 16);
+    str_len = snprintf(str_buf, sizeof(str_buf), "%d\n", iter);
+    str_buf[str_len] = ((char *) buf)[str_len];     // snprintf()'s NUL
+    _mm_stream_si128((__m128i *) buf, _mm_load_si128((const __m128i *) str_buf));
+    _mm_sfence();
+    return (size_t) blocksize;
+#else
+    return payload_header(buf, iter, blocksize);
+#endif
+}
+
+
+/* hardware counter on this thread, -1 where perf_event_open() is not allowed */
+int perf_counter_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+uint64_t perf_counter_read(int fd)
+{
+    uint64_t value = 0;
+
+    if ((fd == -1) || (read(fd, &value, sizeof(value)) != sizeof(value)))
+        return 0;
+    return value;
+}
+
+
+/*
+    persistent worker threads for -j: each logical block is cut into one
+    page aligned chunk per thread and pwrite()n in parallel, the submitter
+    waits until every chunk has landed
+*/
+struct chunk_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start_cv;
+    pthread_cond_t done_cv;
+    pthread_t threads[CHUNKS_MAX];
+    int nthreads;
+    unsigned long generation;
+    int pending;
+    int stop;
+    int fd;
+    const char *buf;
+    size_t len;
+    off_t offset;
+    int error;
+};
+
+struct chunk_worker {
+    struct chunk_pool *pool;
+    int index;
+};
+
+
+static void *chunk_worker_main(void *arg)
+{
+    struct chunk_worker *cw = arg;
+    struct chunk_pool *pool = cw->pool;
+    unsigned long seen = 0;
+    size_t chunk, from, to;
+    ssize_t ws;
+    int _errno;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while ((pool->generation == seen) && !pool->stop)
+            pthread_cond_wait(&pool->start_cv, &pool->lock);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        chunk = (pool->len + pool->nthreads - 1) / pool->nthreads;
+        chunk = (chunk + 4095) & ~(size_t) 4095;
+        from = chunk * cw->index;
+        to = from + chunk < pool->len ? from + chunk : pool->len;
+        _errno = 0;
+        while (from < to) {
+            ws = pwrite(pool->fd, pool->buf + from, to - from, pool->offset + (off_t) from);
+            if (ws <= 0) {
+                _errno = ws == -1 ? errno : EIO;
+                break;
+            }
+            from += (size_t) ws;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (_errno)
+            pool->error = _errno;
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done_cv);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(cw);
+    return NULL;
+}
+
+
+int chunk_pool_init(struct chunk_pool *pool, int nthreads)
+{
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+    for (; pool->nthreads < nthreads; pool->nthreads++) {
+        struct chunk_worker *cw = malloc(sizeof(*cw));
+
+        cw->pool = pool;
+        cw->index = pool->nthreads;
+        if (pthread_create(&pool->threads[pool->nthreads], NULL, chunk_worker_main, cw) != 0) {
+            free(cw);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/* returns 0 once every chunk of buf is written at offset, else an errno */
+int chunk_pool_write(struct chunk_pool *pool, int fd, const void *buf, size_t len, off_t offset)
+{
+    int _errno;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fd = fd;
+    pool->buf = buf;
+    pool->len = len;
+    pool->offset = offset;
+    pool->error = 0;
+    pool->pending = pool->nthreads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start_cv);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    _errno = pool->error;
+    pthread_mutex_unlock(&pool->lock);
+    return _errno;
+}
+
+
+void chunk_pool_destroy(struct chunk_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start_cv);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start_cv);
+    pthread_cond_destroy(&pool->done_cv);
+}
+
+
+/* -j: one single pwrite() and one chunked write of the same block, alternating order */
+static int chunk_compare(struct chunk_pool *pool,
+                         int fd,
+                         const void *write_buf,
+                         size_t write_actual,
+                         int iter,
+                         off_t *offset,
+                         struct lat_hist *single_hist,
+                         struct lat_hist *chunk_hist,
+                         double *single_latency,
+                         double *chunk_latency)
+{
+    double single = 0, chunked = 0, t;
+    ssize_t ws;
+    int _errno = 0;
+
+    for (int n = 0; n < 2; n++) {
+        t = now_mono();
+        if ((n + iter) % 2 == 0) {
+            ws = pwrite(fd, write_buf, write_actual, *offset);
+            single = now_mono() - t;
+            if (ws != (ssize_t) write_actual) {
+                _errno = ws == -1 ? errno : EIO;
+                fprintf(stderr, "pwrite() failed with errno %d (%s)\n", _errno, strerror(_errno));
+            } else
+                hist_record(single_hist, single);
+        } else {
+            int rc = chunk_pool_write(pool, fd, write_buf, write_actual, *offset);
+
+            chunked = now_mono() - t;
+            if (rc) {
+                _errno = rc;
+                fprintf(stderr, "chunked pwrite() failed with errno %d (%s)\n", _errno, strerror(_errno));
+            } else
+                hist_record(chunk_hist, chunked);
+        }
+        *offset += (off_t) write_actual;
+    }
+    *single_latency = single;
+    *chunk_latency = chunked;
+    return _errno;
+}
+
+
+/*
+    -d deferred: write()s are acknowledged from the page cache while a
+    background thread fsync()s every flush interval and advances the
+    "durable up to sequence" watermark
+*/
+struct flusher {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    int stop;
+    int fd;
+    int flush_ms;
+    int quiet;
+    double *write_time;                     /* completion time of each sequence, NAN if it failed */
+    atomic_long written;                    /* sequences [0, written) are in the page cache */
+    atomic_ullong written_bytes;
+    long durable;                           /* sequences [0, durable) are on stable storage */
+    unsigned long long durable_bytes;
+    unsigned long long at_risk_max;
+    struct lat_hist lag_hist;
+    struct lat_hist fsync_hist;
+    unsigned long fsync_failures;
+    int failed;                             /* the watermark stops at the first failed fsync() */
+};
+
+
+static void flusher_flush(struct flusher *fl)
+{
+    long written = atomic_load_explicit(&fl->written, memory_order_acquire);
+    unsigned long long bytes = atomic_load_explicit(&fl->written_bytes, memory_order_acquire);
+    double t, done;
+
+    /*
+        after a failed fsync() the kernel may have dropped the dirty pages
+        and a later fsync() can succeed without them, so nothing past the
+        watermark is known to be durable any more
+    */
+    if ((written == fl->durable) || fl->failed)
+        return;
+    if (bytes - fl->durable_bytes > fl->at_risk_max)
+        fl->at_risk_max = bytes - fl->durable_bytes;
+    t = now_mono();
+    if (fsync(fl->fd) == -1) {
+        run_notice(stderr, "fsync() failed with errno %d (%s)", errno, strerror(errno));
+        fl->fsync_failures++;
+        fl->failed = 1;
+        return;
+    }
+    done = now_mono();
+    hist_record(&fl->fsync_hist, done - t);
+    for (long seq = fl->durable; seq < written; seq++)
+        if (!isnan(fl->write_time[seq]))
+            hist_record(&fl->lag_hist, done - fl->write_time[seq]);
+    if (!fl->quiet)
+        printf("fsync() took approx %.6lf seconds, durable up to sequence %ld\n", done - t, written - 1);
+    fl->durable = written;
+    fl->durable_bytes = bytes;
+}
+
+
+static void *flusher_main(void *arg)
+{
+    struct flusher *fl = arg;
+    struct timespec deadline;
+    int stop;
+
+    for (;;) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += fl->flush_ms / 1000;
+        deadline.tv_nsec += (long) (fl->flush_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&fl->lock);
+        while (!fl->stop && (pthread_cond_timedwait(&fl->cv, &fl->lock, &deadline) == 0))
+            ;
+        stop = fl->stop;
+        pthread_mutex_unlock(&fl->lock);
+        flusher_flush(fl);
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+
+/* FIRST is the sequence a resumed run starts at, anything before it is durable */
+int flusher_start(struct flusher *fl, int fd, int flush_ms, long first, int iterations, int quiet)
+{
+    memset(fl, 0, sizeof(*fl));
+    fl->fd = fd;
+    fl->flush_ms = flush_ms;
+    fl->quiet = quiet;
+    fl->write_time = malloc(sizeof(*fl->write_time) * (size_t) iterations);
+    // sequences that never get a flusher_note_write() failed
+    for (int seq = 0; seq < iterations; seq++)
+        fl->write_time[seq] = NAN;
+    atomic_init(&fl->written, first);
+    atomic_init(&fl->written_bytes, 0);
+    fl->durable = first;
+    hist_init(&fl->lag_hist);
+    hist_init(&fl->fsync_hist);
+    pthread_mutex_init(&fl->lock, NULL);
+    pthread_cond_init(&fl->cv, NULL);
+    if (pthread_create(&fl->thread, NULL, flusher_main, fl) != 0) {
+        free(fl->write_time);
+        fl->write_time = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+/* called by the writer once sequence seq is in the page cache */
+void flusher_note_write(struct flusher *fl, long seq, size_t bytes)
+{
+    fl->write_time[seq] = now_mono();
+    atomic_fetch_add_explicit(&fl->written_bytes, bytes, memory_order_relaxed);
+    atomic_store_explicit(&fl->written, seq + 1, memory_order_release);
+}
+
+
+/* final fsync and release, without a report */
+void flusher_cancel(struct flusher *fl)
+{
+    pthread_mutex_lock(&fl->lock);
+    fl->stop = 1;
+    pthread_cond_signal(&fl->cv);
+    pthread_mutex_unlock(&fl->lock);
+    pthread_join(fl->thread, NULL);
+    pthread_mutex_destroy(&fl->lock);
+    pthread_cond_destroy(&fl->cv);
+    free(fl->write_time);
+    fl->write_time = NULL;
+}
+
+
+/* final fsync, then report how far behind the watermark ran */
+void flusher_stop(struct flusher *fl)
+{
+    flusher_cancel(fl);
+    hist_print("fsync()", &fl->fsync_hist);
+    hist_print("durability lag", &fl->lag_hist);
+    printf("Max bytes at risk: %llu\n", fl->at_risk_max);
+    if (fl->fsync_failures)
+        printf("fsync() failures: %lu, nothing after sequence %ld is known to be durable\n",
+            fl->fsync_failures,
+            fl->durable - 1);
+}
+
+
+/* bytes written per one second slot since the start of the run */
+struct throughput {
+    double start;
+    unsigned long long *slot;
+    size_t nslots;
+};
+
+
+void throughput_init(struct throughput *tp)
+{
+    tp->start = now_mono();
+    tp->slot = NULL;
+    tp->nslots = 0;
+}
+
+
+void throughput_add(struct throughput *tp, unsigned long long bytes)
+{
+    size_t s = (size_t) (now_mono() - tp->start);
+
+    if (s >= tp->nslots) {
+        tp->slot = realloc(tp->slot, sizeof(*tp->slot) * (s + 1));
+        memset(tp->slot + tp->nslots, 0, sizeof(*tp->slot) * (s + 1 - tp->nslots));
+        tp->nslots = s + 1;
+    }
+    tp->slot[s] += bytes;
+}
+
+
+/* the last, partial, second is left out of the spread */
+void throughput_print(struct throughput *tp)
+{
+    size_t n = tp->nslots > 1 ? tp->nslots - 1 : tp->nslots;
+    double sum = 0, sq = 0, mean, min = 0, max = 0;
+
+    if (n == 0)
+        return;
+    for (size_t s = 0; s < n; s++) {
+        double mb = (double) tp->slot[s] / (1024 * 1024);
+
+        sum += mb;
+        sq += mb * mb;
+        if ((s == 0) || (mb < min))
+            min = mb;
+        if (mb > max)
+            max = mb;
+    }
+    mean = sum / n;
+    printf("%-18s: %zu s min=%.2lf avg=%.2lf max=%.2lf MiB/s cov=%.3lf\n",
+        "throughput",
+        n,
+        min,
+        mean,
+        max,
+        mean > 0 ? sqrt(sq / n - mean * mean > 0 ? sq / n - mean * mean : 0) / mean : 0);
+    free(tp->slot);
+}
+
+
+/*
+    RAPL energy of the powercap package and core zones.  energy_uj is a
+    free running microjoule counter that wraps at max_energy_range_uj,
+    so each zone keeps a total of the deltas between samples; a zone
+    is only miscounted if it wraps twice between two samples, minutes
+    apart even at full package power.
+*/
+struct rapl_zone {
+    int fd;
+    int core;                               /* else a package */
+    unsigned long long range;
+    unsigned long long last;
+    unsigned long long total;
+};
+
+struct rapl {
+    int n;
+    struct rapl_zone zone[RAPL_DOMAINS_MAX];
+};
+
+
+static int rapl_read(int fd, unsigned long long *uj)
+{
+    char buf[32];
+    ssize_t n;
+
+    if ((n = pread(fd, buf, sizeof(buf) - 1, 0)) <= 0)
+        return -1;
+    buf[n] = '\0';
+    *uj = strtoull(buf, NULL, 10);
+    return 0;
+}
+
+
+/* first line of RAPL_ROOT/ZONE/ATTR, without the newline */
+static int rapl_attr(const char *zone, const char *attr, char *buf, int size)
+{
+    char path[PATH_MAX];
+    FILE *f;
+    int rc = -1;
+
+    snprintf(path, sizeof(path), "%s/%s/%s", RAPL_ROOT, zone, attr);
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+    if (fgets(buf, size, f) != NULL) {
+        buf[strcspn(buf, "\n")] = '\0';
+        rc = 0;
+    }
+    fclose(f);
+    return rc;
+}
+
+
+/* -1 with errno EACCES when zones exist but energy_uj is root only */
+int rapl_open(struct rapl *r)
+{
+    char path[PATH_MAX], name[64], range[32];
+    struct rapl_zone *z;
+    struct dirent *de;
+    DIR *dir;
+    int denied = 0;
+
+    r->n = 0;
+    if ((dir = opendir(RAPL_ROOT)) == NULL)
+        return -1;
+    while (((de = readdir(dir)) != NULL) && (r->n < RAPL_DOMAINS_MAX)) {
+        // intel-rapl:N packages and their intel-rapl:N:M subzones, not intel-rapl-mmio
+        if (strncmp(de->d_name, "intel-rapl:", 11) != 0)
+            continue;
+        if ((rapl_attr(de->d_name, "name", name, sizeof(name)) == -1) ||
+            (rapl_attr(de->d_name, "max_energy_range_uj", range, sizeof(range)) == -1))
+            continue;
+        if ((strncmp(name, "package-", 8) != 0) && (strcmp(name, "core") != 0))
+            continue;
+        z = &r->zone[r->n];
+        snprintf(path, sizeof(path), "%s/%s/energy_uj", RAPL_ROOT, de->d_name);
+        if ((z->fd = open(path, O_RDONLY|O_CLOEXEC)) == -1) {
+            denied |= errno == EACCES;
+            continue;
+        }
+        if (rapl_read(z->fd, &z->last) == -1) {
+            close(z->fd);
+            continue;
+        }
+        z->core = name[0] == 'c';
+        z->range = strtoull(range, NULL, 10);
+        z->total = 0;
+        r->n++;
+    }
+    closedir(dir);
+    if (r->n == 0) {
+        errno = denied ? EACCES : ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+
+void rapl_sample(struct rapl *r)
+{
+    unsigned long long now;
+
+    for (int i = 0; i < r->n; i++) {
+        struct rapl_zone *z = &r->zone[i];
+
+        if (rapl_read(z->fd, &now) == -1)
+            continue;
+        // a counter below its last sample went past max_energy_range_uj
+        z->total += now >= z->last ? now - z->last : z->range - z->last + now;
+        z->last = now;
+    }
+}
+
+
+/* joules since rapl_open() of the package zones, or the core zones; -1 without any */
+double rapl_joules(const struct rapl *r, int core)
+{
+    unsigned long long uj = 0;
+    int found = 0;
+
+    for (int i = 0; i < r->n; i++) {
+        if (r->zone[i].core == core) {
+            uj += r->zone[i].total;
+            found = 1;
+        }
+    }
+    return found ? (double) uj / 1e6 : -1;
+}
+
+
+void rapl_close(struct rapl *r)
+{
+    for (int i = 0; i < r->n; i++)
+        close(r->zone[i].fd);
+    free(r);
+}
+
+
+/*
+    -d writebehind: start writeback of each window as soon as it is complete,
+    wait for the window before it and drop its pages from the page cache so a
+    long stream neither fills memory with dirty pages nor stalls in bulk
+*/
+struct writebehind {
+    int fd;
+    off_t window;
+    off_t written;
+    off_t next;                             /* windows [0, next) have been started */
+    struct lat_hist wait_hist;
+};
+
+
+void writebehind_init(struct writebehind *wb, int fd, off_t window)
+{
+    wb->fd = fd;
+    wb->window = window;
+    wb->written = 0;
+    wb->next = 0;
+    hist_init(&wb->wait_hist);
+}
+
+
+static void writebehind_retire(struct writebehind *wb, off_t from, off_t len)
+{
+    double t = now_mono();
+
+    if (sync_file_range(wb->fd, from, len,
+            SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER) == -1)
+        fprintf(stderr, "sync_file_range() failed with errno %d (%s)\n", errno, strerror(errno));
+    hist_record(&wb->wait_hist, now_mono() - t);
+    posix_fadvise(wb->fd, from, len, POSIX_FADV_DONTNEED);
+}
+
+
+void writebehind_note_write(struct writebehind *wb, size_t bytes)
+{
+    wb->written += (off_t) bytes;
+    while (wb->written >= (wb->next + 1) * wb->window) {
+        sync_file_range(wb->fd, wb->next * wb->window, wb->window, SYNC_FILE_RANGE_WRITE);
+        if (wb->next > 0)
+            writebehind_retire(wb, (wb->next - 1) * wb->window, wb->window);
+        wb->next++;
+    }
+}
+
+
+void writebehind_finish(struct writebehind *wb)
+{
+    if (wb->next > 0)
+        writebehind_retire(wb, (wb->next - 1) * wb->window, wb->window);
+    if (wb->written > wb->next * wb->window)
+        writebehind_retire(wb, wb->next * wb->window, wb->written - wb->next * wb->window);
+    hist_print("window wait", &wb->wait_hist);
+}
+
+
+/*
+    -p iov: a block is described by an iovec array whose first segment is a
+    private copy carrying the iteration's header and whose other segments
+    all point at the same pre-filled pattern, so memory per writer stays at
+    two segments plus the array whatever the block size
+*/
+struct iov_payload {
+    char *head;
+    char *pattern;
+    struct iovec *iov;
+    int iovcnt;
+};
+
+
+int iov_payload_init(struct iov_payload *ip, size_t blocksize)
+{
+    size_t segments = (blocksize + IOV_SEGMENT - 1) / IOV_SEGMENT;
+
+    ip->head = malloc(IOV_SEGMENT);
+    ip->pattern = malloc(IOV_SEGMENT);
+    ip->iov = calloc(segments ? segments : 1, sizeof(*ip->iov));
+    ip->iovcnt = 0;
+    if (!ip->head || !ip->pattern || !ip->iov)
+        return -1;
+    memset(ip->head, '\r', IOV_SEGMENT);
+    memset(ip->pattern, '\r', IOV_SEGMENT);
+    return 0;
+}
+
+
+/* lay out write_actual bytes over head + repeated pattern */
+static void iov_payload_build(struct iov_payload *ip, size_t write_actual)
+{
+    size_t left = write_actual;
+
+    ip->iovcnt = 0;
+    while (left) {
+        size_t len = left < IOV_SEGMENT ? left : IOV_SEGMENT;
+
+        ip->iov[ip->iovcnt].iov_base = ip->iovcnt ? ip->pattern : ip->head;
+        ip->iov[ip->iovcnt].iov_len = len;
+        ip->iovcnt++;
+        left -= len;
+    }
+}
+
+
+/* writev() in IOV_MAX batches; a short batch ends the block like a short write() */
+ssize_t iov_payload_write(struct iov_payload *ip, int fd, size_t write_actual)
+{
+    ssize_t total = 0, ws, want;
+
+    iov_payload_build(ip, write_actual);
+    for (int from = 0; from < ip->iovcnt; from += IOV_MAX) {
+        int cnt = ip->iovcnt - from < IOV_MAX ? ip->iovcnt - from : IOV_MAX;
+
+        want = 0;
+        for (int i = from; i < from + cnt; i++)
+            want += (ssize_t) ip->iov[i].iov_len;
+        ws = writev(fd, ip->iov + from, cnt);
+        if (ws == -1)
+            return total ? total : -1;
+        total += ws;
+        if (ws != want)
+            break;
+    }
+    return total;
+}
+
+
+void iov_payload_free(struct iov_payload *ip)
+{
+    free(ip->head);
+    free(ip->pattern);
+    free(ip->iov);
+}
+
+
+/*
+    -R SECONDS: flight recorder.  Every iteration leaves a detailed record in
+    an in-memory ring; when the latency detector (EWMA mean and deviation)
+    or a run of failures trips, the records of the last SECONDS are dumped
+    to a file and the records of the following -A seconds are appended.
+*/
+struct flight_record {
+    double when;                            /* CLOCK_REALTIME */
+    int seq;
+    int err;
+    size_t bytes;
+    double latency;
+    double user;
+    double sys;
+    double loadavg;
+    unsigned long dirty_kb;
+    unsigned long writeback_kb;
+    uint64_t ctx_switches;
+    uint64_t page_faults;
+    double ewma;
+};
+
+struct flight_recorder {
+    struct flight_record ring[FLIGHT_RING];
+    unsigned long head;                     /* records pushed so far */
+    int window;
+    int after;
+    double ewma;
+    double ewvar;
+    unsigned long samples;
+    int fail_streak;
+    FILE *dump;
+    double dump_until;
+    int dumps;
+    int cs_fd;
+    int pf_fd;
+};
+
+
+void flight_recorder_init(struct flight_recorder *fr, int window, int after)
+{
+    memset(fr, 0, sizeof(*fr));
+    fr->window = window;
+    fr->after = after;
+    fr->cs_fd = perf_counter_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+    fr->pf_fd = perf_counter_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+}
+
+
+/* system state that explains stalls: load, dirty and writeback pages, switches, faults */
+static void flight_sample(struct flight_recorder *fr, struct flight_record *rec)
+{
+    struct rusage ru;
+    char line[128];
+    FILE *f;
+
+    if ((f = fopen("/proc/loadavg", "r")) != NULL) {
+        if (fscanf(f, "%lf", &rec->loadavg) != 1)
+            rec->loadavg = 0;
+        fclose(f);
+    }
+    if ((f = fopen("/proc/meminfo", "r")) != NULL) {
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "Dirty: %lu", &rec->dirty_kb) == 1)
+                continue;
+            if (sscanf(line, "Writeback: %lu", &rec->writeback_kb) == 1)
+                break;
+        }
+        fclose(f);
+    }
+    if ((fr->cs_fd != -1) && (fr->pf_fd != -1)) {
+        rec->ctx_switches = perf_counter_read(fr->cs_fd);
+        rec->page_faults = perf_counter_read(fr->pf_fd);
+    } else {
+        getrusage(RUSAGE_SELF, &ru);
+        rec->ctx_switches = (uint64_t) (ru.ru_nvcsw + ru.ru_nivcsw);
+        rec->page_faults = (uint64_t) (ru.ru_minflt + ru.ru_majflt);
+    }
+}
+
+
+static void flight_write(FILE *f, const struct flight_record *r)
+{
+    fprintf(f, "%.6lf,%d,%d,%zu,%.6lf,%.2lf,%.2lf,%.2lf,%lu,%lu,%llu,%llu,%.6lf\n",
+        r->when,
+        r->seq,
+        r->err,
+        r->bytes,
+        r->latency,
+        r->user,
+        r->sys,
+        r->loadavg,
+        r->dirty_kb,
+        r->writeback_kb,
+        (unsigned long long) r->ctx_switches,
+        (unsigned long long) r->page_faults,
+        r->ewma);
+}
+
+
+static void flight_trigger(struct flight_recorder *fr, const struct flight_record *cause, const char *why)
+{
+    unsigned long first = fr->head > FLIGHT_RING ? fr->head - FLIGHT_RING : 0;
+    double span = cause->when - fr->ring[first % FLIGHT_RING].when;
+    char path[64];
+
+    snprintf(path, sizeof(path), "timed-writer.flight.%d.%d.csv", (int) getpid(), ++fr->dumps);
+    if ((fr->dump = fopen(path, "w")) == NULL) {
+        run_notice(stderr, "Unable to open flight recorder dump %s : %s", path, strerror(errno));
+        return;
+    }
+    run_notice(stdout, "Flight recorder triggered by %s at sequence %d, dumping to %s", why, cause->seq, path);
+    fprintf(fr->dump, "# trigger: %s at sequence %d\n", why, cause->seq);
+    // fast runs wrap the ring well inside -R, say how much is really there
+    if (first && (span < fr->window)) {
+        run_notice(stdout, "Flight recorder ring of %d records covers only the last %.3lf of %d s",
+            FLIGHT_RING,
+            span,
+            fr->window);
+        fprintf(fr->dump, "# covers only the last %.3lf of %d s, the ring holds %d records\n",
+            span,
+            fr->window,
+            FLIGHT_RING);
+    }
+    fprintf(fr->dump, "time,seq,errno,bytes,latency,user,sys,loadavg,dirty_kb,writeback_kb,"
+        "ctx_switches,page_faults,ewma\n");
+    for (unsigned long i = first; i < fr->head; i++) {
+        const struct flight_record *r = &fr->ring[i % FLIGHT_RING];
+
+        if (r->when >= cause->when - fr->window)
+            flight_write(fr->dump, r);
+    }
+    fflush(fr->dump);
+    fr->dump_until = cause->when + fr->after;
+}
+
+
+/* record one iteration, run the detector and feed an open dump */
+void flight_recorder_push(struct flight_recorder *fr, struct flight_record *rec)
+{
+    const char *why = NULL;
+    double dev;
+
+    flight_sample(fr, rec);
+    if (rec->err) {
+        if (++fr->fail_streak == FLIGHT_FAIL_STREAK)
+            why = "consecutive failures";
+    } else {
+        fr->fail_streak = 0;
+        if (fr->samples == 0)
+            fr->ewma = rec->latency;
+        dev = rec->latency - fr->ewma;
+        if ((fr->samples >= FLIGHT_WARMUP) &&
+            (dev > FLIGHT_SIGMAS * sqrt(fr->ewvar)) &&
+            (rec->latency > 2 * fr->ewma))
+            why = "latency outlier";
+        // outliers are not folded into the baseline they are judged against
+        if (!why || (fr->samples < FLIGHT_WARMUP)) {
+            fr->ewma += FLIGHT_ALPHA * dev;
+            fr->ewvar = (1 - FLIGHT_ALPHA) * (fr->ewvar + FLIGHT_ALPHA * dev * dev);
+            fr->samples++;
+        }
+    }
+    rec->ewma = fr->ewma;
+    fr->ring[fr->head++ % FLIGHT_RING] = *rec;
+
+    if (fr->dump) {
+        flight_write(fr->dump, rec);
+        if (rec->when >= fr->dump_until) {
+            fclose(fr->dump);
+            fr->dump = NULL;
+        }
+    } else if (why)
+        flight_trigger(fr, rec, why);
+}
+
+
+void flight_recorder_close(struct flight_recorder *fr)
+{
+    if (fr->dump)
+        fclose(fr->dump);
+    if (fr->cs_fd != -1)
+        close(fr->cs_fd);
+    if (fr->pf_fd != -1)
+        close(fr->pf_fd);
+    if (fr->dumps)
+        printf("Flight recorder dumps: %d\n", fr->dumps);
+}
+
+
+/*
+    -T THRESHOLD_MS: adaptive sampling.  Writes follow SLEEP until one is
+    slower than the threshold or fails, then repeat every BURST_MS until
+    ADAPT_RECOVER writes in a row are fast again.  Each such brownout is
+    bracketed by the last good write before it and the first write of
+    the recovery run.
+*/
+struct brownout {
+    double last_good;                       /* end of the last good write before, CLOCK_REALTIME */
+    double start;                           /* start of the first bad write */
+    double end;                             /* start of the first write of the recovery run */
+    unsigned long writes;
+    unsigned long failures;
+    double max_latency;
+    double sum_latency;
+};
+
+struct adaptive {
+    double threshold;
+    double burst;
+    int in_burst;
+    int good_run;
+    double last_good;
+    double recovery_start;
+    struct brownout cur;
+    struct brownout *episodes;
+    int nepisodes;
+};
+
+
+void adaptive_init(struct adaptive *ad, int threshold_ms, int burst_ms)
+{
+    memset(ad, 0, sizeof(*ad));
+    ad->threshold = (double) threshold_ms / 1000;
+    ad->burst = (double) burst_ms / 1000;
+}
+
+
+/* account for a write that started at start (CLOCK_REALTIME), returns the pause before the next one */
+double adaptive_note(struct adaptive *ad, double start, double latency, int ok, double interval)
+{
+    int bad = !ok || (latency > ad->threshold);
+
+    if (!ad->in_burst) {
+        if (!bad) {
+            ad->last_good = start + latency;
+            return interval;
+        }
+        memset(&ad->cur, 0, sizeof(ad->cur));
+        ad->cur.last_good = ad->last_good;
+        ad->cur.start = start;
+        ad->in_burst = 1;
+        ad->good_run = 0;
+        run_notice(stdout, "Brownout started, sampling every %.3lf seconds", ad->burst);
+    }
+    ad->cur.writes++;
+    if (!ok)
+        ad->cur.failures++;
+    else {
+        ad->cur.sum_latency += latency;
+        if (latency > ad->cur.max_latency)
+            ad->cur.max_latency = latency;
+    }
+    if (bad) {
+        ad->good_run = 0;
+        return ad->burst;
+    }
+    if (ad->good_run++ == 0)
+        ad->recovery_start = start;
+    if (ad->good_run < ADAPT_RECOVER)
+        return ad->burst;
+
+    ad->cur.end = ad->recovery_start;
+    ad->episodes = realloc(ad->episodes, sizeof(*ad->episodes) * (ad->nepisodes + 1));
+    ad->episodes[ad->nepisodes++] = ad->cur;
+    run_notice(stdout, "Brownout ended after %.3lf seconds (max latency %.6lf seconds, %lu failures)",
+        ad->cur.end - ad->cur.start,
+        ad->cur.max_latency,
+        ad->cur.failures);
+    ad->in_burst = 0;
+    ad->last_good = start + latency;
+    return interval;
+}
+
+
+static void format_real(char *buf, size_t size, double when)
+{
+    time_t secs = (time_t) when;
+    struct tm tm;
+
+    localtime_r(&secs, &tm);
+    strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf + strlen(buf), size - strlen(buf), ".%03d", (int) ((when - (double) secs) * 1000));
+}
+
+
+void adaptive_report(struct adaptive *ad)
+{
+    char last_good[40], start[40], end[40];
+
+    if (ad->in_burst) {
+        ad->cur.end = 0;
+        ad->episodes = realloc(ad->episodes, sizeof(*ad->episodes) * (ad->nepisodes + 1));
+        ad->episodes[ad->nepisodes++] = ad->cur;
+    }
+    printf("Brownouts: %d\n", ad->nepisodes);
+    for (int i = 0; i < ad->nepisodes; i++) {
+        struct brownout *b = &ad->episodes[i];
+        unsigned long ok = b->writes - b->failures;
+
+        format_real(last_good, sizeof(last_good), b->last_good);
+        format_real(start, sizeof(start), b->start);
+        if (b->end)
+            format_real(end, sizeof(end), b->end);
+        else
+            strcpy(end, "(still on at exit)");
+        printf("  %s .. %s -> %s : %.3lf s, %lu writes, %lu failed, avg %.6lf s, max %.6lf s\n",
+            b->last_good ? last_good : "(start of run)",
+            start,
+            end,
+            b->end ? b->end - b->start : 0,
+            b->writes,
+            b->failures,
+            ok ? b->sum_latency / ok : 0,
+            b->max_latency);
+    }
+    free(ad->episodes);
+}
+
+
+/* nanosleep() through EINTR */
+void sleep_for(double seconds)
+{
+    struct timespec ts;
+
+    // -s 0 means don't sleep, and nanosleep() of 0 still costs a timer round trip
+    if (seconds <= 0)
+        return;
+    ts.tv_sec = (time_t) seconds;
+    ts.tv_nsec = (long) ((seconds - (double) ts.tv_sec) * 1000000000);
+    while ((nanosleep(&ts, &ts) == -1) && (errno == EINTR))
+        ;
+}
+
+
+/*
+    -D: a full-screen view of a line run drawn with plain ANSI escapes by
+    its own thread.  The thread only reads the run's live metrics through
+    the seqlock, so a slow terminal never holds up a write.  Rolling
+    figures come from the difference between the newest snapshot and the
+    one DASHBOARD_WINDOW seconds older.
+*/
+struct dashboard {
+    struct live_metrics *lm;
+    const char *filename;
+    pthread_t thread;
+    atomic_int stop;
+    struct live_metrics *ring;              /* one snapshot per refresh over DASHBOARD_WINDOW */
+    int slots;
+    int filled;                             /* snapshots before head */
+    int head;                               /* the previous refresh */
+    double spark[DASHBOARD_SPARK];          /* p99 per refresh, 0 when idle */
+    int spark_head;
+};
+
+
+#define DASHBOARD_ENTER     "\033[?1049h\033[?25l"
+#define DASHBOARD_LEAVE     "\033[?25h\033[?1049l"
+
+
+/* counts in now but not then; max is the top bucket's bound */
+static void hist_subtract(struct lat_hist *dst, const struct lat_hist *now, const struct lat_hist *then)
+{
+    int top = -1;
+
+    hist_init(dst);
+    dst->count = now->count - then->count;
+    dst->sum = now->sum - then->sum;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->bucket[i] = now->bucket[i] - then->bucket[i];
+        if (dst->bucket[i]) {
+            if (top == -1)
+                dst->min = i ? hist_bucket_limit(i - 1) : 0;
+            top = i;
+        }
+    }
+    if (top != -1)
+        dst->max = hist_bucket_limit(top) < now->max ? hist_bucket_limit(top) : now->max;
+}
+
+
+static int dashboard_sparkline(char *buf, size_t size, const struct dashboard *db)
+{
+    static const char *blocks[] = { "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+    double lo = 0, hi = 0, v;
+    int len = 0, level;
+
+    for (int i = 0; i < DASHBOARD_SPARK; i++) {
+        v = db->spark[i];
+        if (v > 0) {
+            lo = (lo == 0) || (v < lo) ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+    }
+    // log scale so one slow write doesn't flatten the rest
+    for (int i = 0; (i < DASHBOARD_SPARK) && (len < (int) size - 4); i++) {
+        v = db->spark[(db->spark_head + i) % DASHBOARD_SPARK];
+        if (v <= 0) {
+            buf[len++] = ' ';
+            continue;
+        }
+        level = hi > lo ? (int) (log(v / lo) / log(hi / lo) * 7 + 0.5) : 0;
+        len += snprintf(buf + len, size - (size_t) len, "%s", blocks[level]);
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+
+static void dashboard_draw(struct dashboard *db, const struct live_metrics *now)
+{
+    const struct live_metrics *second, *oldest, *prev;
+    struct lat_hist window, lock, tick;
+    char frame[DASHBOARD_FRAME_MAX], spark[DASHBOARD_SPARK * 4];
+    double span;
+    int len, back;
+
+    // a second ago for rates, the oldest snapshot kept for percentiles
+    back = db->filled + 1 < DASHBOARD_HZ ? db->filled + 1 : DASHBOARD_HZ;
+    second = &db->ring[(db->head - back + 1 + db->slots) % db->slots];
+    oldest = &db->ring[(db->head - db->filled + db->slots) % db->slots];
+    prev = &db->ring[db->head];
+    hist_subtract(&window, &now->hist, &oldest->hist);
+    hist_subtract(&lock, &now->lock_hist, &oldest->lock_hist);
+    hist_subtract(&tick, &now->hist, &prev->hist);
+    db->spark[db->spark_head] = tick.count ? hist_percentile(&tick, 99) : 0;
+    db->spark_head = (db->spark_head + 1) % DASHBOARD_SPARK;
+    span = (double) back / DASHBOARD_HZ;
+    dashboard_sparkline(spark, sizeof(spark), db);
+
+    len = snprintf(frame, sizeof(frame),
+        "\033[H\033[2J"
+        "timed-writer %s  pid %d  up %.0lf s\n\n"
+        "  writes      %12lu   failures %lu   streak %lu\n"
+        "  IOPS        %12.1lf   MB/s %.2lf\n\n"
+        "  last %2d s    p50 %10.3lf ms   p99 %10.3lf ms   max %10.3lf ms   n=%lu\n",
+        db->filename,
+        now->pid,
+        now->updated - now->started,
+        now->iterations,
+        now->failures,
+        now->failure_streak,
+        (double) (now->iterations - second->iterations) / span,
+        (double) (now->bytes - second->bytes) / span / 1000000,
+        DASHBOARD_WINDOW,
+        hist_percentile(&window, 50) * 1000,
+        hist_percentile(&window, 99) * 1000,
+        window.max * 1000,
+        window.count);
+    if (now->lock_hist.count)
+        len += snprintf(frame + len, sizeof(frame) - (size_t) len,
+            "  lock wait    p50 %10.3lf ms   p99 %10.3lf ms   max %10.3lf ms   n=%lu\n",
+            hist_percentile(&lock, 50) * 1000,
+            hist_percentile(&lock, 99) * 1000,
+            lock.max * 1000,
+            lock.count);
+    len += snprintf(frame + len, sizeof(frame) - (size_t) len,
+        "\n  p99 per %d ms, last %d s\n  |%s|\n",
+        1000 / DASHBOARD_HZ,
+        DASHBOARD_SPARK / DASHBOARD_HZ,
+        spark);
+    pthread_mutex_lock(&notice_lock);
+    if (notice_line[0])
+        len += snprintf(frame + len, sizeof(frame) - (size_t) len, "\n  %s\n", notice_line);
+    pthread_mutex_unlock(&notice_lock);
+    if (len > (int) sizeof(frame) - 1)
+        len = (int) sizeof(frame) - 1;
+    if (write(STDOUT_FILENO, frame, (size_t) len) == -1)
+        atomic_store(&db->stop, 1);
+}
+
+
+static void *dashboard_main(void *arg)
+{
+    struct dashboard *db = arg;
+    struct live_metrics snap;
+
+    while (!atomic_load(&db->stop)) {
+        if (live_metrics_snapshot(db->lm, &snap) == 0) {
+            dashboard_draw(db, &snap);
+            db->head = (db->head + 1) % db->slots;
+            db->ring[db->head] = snap;
+            if (db->filled < db->slots - 1)
+                db->filled++;
+        }
+        sleep_for(1.0 / DASHBOARD_HZ);
+    }
+    return NULL;
+}
+
+
+static void dashboard_restore(void)
+{
+    ssize_t ws = write(STDOUT_FILENO, DASHBOARD_LEAVE, sizeof(DASHBOARD_LEAVE) - 1);
+
+    (void) ws;
+}
+
+
+/* leave the alternate screen even when interrupted */
+static void dashboard_signal(int sig)
+{
+    dashboard_restore();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+
+struct dashboard *dashboard_start(struct live_metrics *lm, const char *filename)
+{
+    struct dashboard *db;
+
+    if ((db = calloc(1, sizeof(*db))) == NULL)
+        return NULL;
+    db->lm = lm;
+    db->filename = filename;
+    db->slots = DASHBOARD_HZ * DASHBOARD_WINDOW;
+    if ((db->ring = calloc((size_t) db->slots, sizeof(*db->ring))) == NULL) {
+        free(db);
+        return NULL;
+    }
+    atomic_init(&db->stop, 0);
+    live_metrics_snapshot(lm, &db->ring[0]);
+    fflush(stdout);
+    if ((write(STDOUT_FILENO, DASHBOARD_ENTER, sizeof(DASHBOARD_ENTER) - 1) != -1) &&
+        (pthread_create(&db->thread, NULL, dashboard_main, db) == 0)) {
+        signal(SIGINT, dashboard_signal);
+        signal(SIGTERM, dashboard_signal);
+        pthread_mutex_lock(&notice_lock);
+        notice_held = 1;
+        notice_line[0] = '\0';
+        pthread_mutex_unlock(&notice_lock);
+        return db;
+    }
+    dashboard_restore();
+    free(db->ring);
+    free(db);
+    return NULL;
+}
+
+
+void dashboard_stop(struct dashboard *db)
+{
+    atomic_store(&db->stop, 1);
+    pthread_join(db->thread, NULL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    dashboard_restore();
+    // the last event is still worth having once the screen is back
+    pthread_mutex_lock(&notice_lock);
+    notice_held = 0;
+    if (notice_line[0])
+        printf("Last event: %s\n", notice_line);
+    pthread_mutex_unlock(&notice_lock);
+    free(db->ring);
+    free(db);
+}
+
+
+/*
+    -E: the writes of a line run go through an engine instead of write(),
+    either the built-in write engine below or a plugin dlopen()ed at
+    startup (see timedwriter.h).  The loop submits one io and reaps it
+    before moving on, so the latency recorded is the engine's from submit
+    to completion; submit() and reap() take batches for engines that
+    gain from them.
+*/
+struct write_engine {
+    int fd;
+    int ndone;
+    struct tw_io *done[WRITE_ENGINE_BATCH];
+};
+
+struct engine_plugin {
+    void *dl;                               /* NULL for the built-in engine */
+    const struct tw_engine *ops;            /* &engine, or the built-in one */
+    struct tw_engine engine;                /* the plugin's, zero past its size */
+    void *ctx;
+    struct tw_io io;
+};
+
+
+static void *write_engine_open(const char *target, int flags, const char *args)
+{
+    struct write_engine *we;
+    int _errno;
+
+    (void) args;
+    if ((we = calloc(1, sizeof(*we))) == NULL)
+        return NULL;
+    if ((we->fd = open(target, O_WRONLY|O_CREAT|O_TRUNC|(flags & TW_ENGINE_OSYNC ? O_SYNC : 0),
+            (mode_t) 0666)) == -1) {
+        _errno = errno;
+        free(we);
+        errno = _errno;
+        return NULL;
+    }
+    return we;
+}
+
+
+/* writes complete inside submit(), reap() only hands them back */
+static int write_engine_submit(void *ctx, struct tw_io **ios, int n)
+{
+    struct write_engine *we = ctx;
+    ssize_t ws;
+    int i;
+
+    for (i = 0; (i < n) && (we->ndone < WRITE_ENGINE_BATCH); i++) {
+        ws = pwrite(we->fd, ios[i]->buf, ios[i]->len, (off_t) ios[i]->offset);
+        ios[i]->res = ws == -1 ? -errno : (long long) ws;
+        we->done[we->ndone++] = ios[i];
+    }
+    return i;
+}
+
+
+static int write_engine_reap(void *ctx, struct tw_io **done, int min, int max)
+{
+    struct write_engine *we = ctx;
+    int n = we->ndone < max ? we->ndone : max;
+
+    (void) min;
+    memcpy(done, we->done, sizeof(*done) * n);
+    memmove(we->done, we->done + n, sizeof(*done) * (we->ndone - n));
+    we->ndone -= n;
+    return n;
+}
+
+
+static int write_engine_flush(void *ctx)
+{
+    struct write_engine *we = ctx;
+
+    return fdatasync(we->fd);
+}
+
+
+static int write_engine_close(void *ctx)
+{
+    struct write_engine *we = ctx;
+    int rc = close(we->fd);
+
+    free(we);
+    return rc;
+}
+
+
+static const struct tw_engine write_engine = {
+    .abi_version = TW_ENGINE_ABI_VERSION,
+    .size = sizeof(struct tw_engine),
+    .name = "write",
+    .max_batch = WRITE_ENGINE_BATCH,
+    .open = write_engine_open,
+    .submit = write_engine_submit,
+    .reap = write_engine_reap,
+    .flush = write_engine_flush,
+    .close = write_engine_close,
+};
+
+
+/* spec is write, or PATH of a plugin, either optionally followed by :ARGS */
+int engine_plugin_open(struct engine_plugin *ep, const char *spec, const char *target, int flags)
+{
+    char path[PATH_MAX], *args;
+    tw_engine_entry_fn entry;
+    const struct tw_engine *ops;
+
+    memset(ep, 0, sizeof(*ep));
+    snprintf(path, sizeof(path), "%s", spec);
+    if ((args = strchr(path, ':')) != NULL)
+        *args++ = '\0';
+    if (strcmp(path, "write") == 0)
+        ops = &write_engine;
+    else {
+        if ((ep->dl = dlopen(path, RTLD_NOW|RTLD_LOCAL)) == NULL) {
+            fprintf(stderr, "Unable to load engine %s : %s\n", path, dlerror());
+            return -1;
+        }
+        if ((entry = (tw_engine_entry_fn) dlsym(ep->dl, TW_ENGINE_ENTRY)) == NULL) {
+            fprintf(stderr, "%s doesn't export %s()\n", path, TW_ENGINE_ENTRY);
+            goto fail;
+        }
+        if ((ops = entry()) == NULL) {
+            fprintf(stderr, "%s() of %s returned no engine\n", TW_ENGINE_ENTRY, path);
+            goto fail;
+        }
+        if (ops->abi_version != TW_ENGINE_ABI_VERSION) {
+            fprintf(stderr, "%s is built for engine ABI %d, expecting %d\n",
+                path,
+                ops->abi_version,
+                TW_ENGINE_ABI_VERSION);
+            goto fail;
+        }
+        if (ops->size < TW_ENGINE_SIZE_MIN) {
+            fprintf(stderr, "%s has a struct tw_engine of %u bytes, at least %zu expected\n",
+                path,
+                ops->size,
+                TW_ENGINE_SIZE_MIN);
+            goto fail;
+        }
+        // members the plugin's header didn't have yet read as absent
+        memcpy(&ep->engine, ops, ops->size < sizeof(ep->engine) ? ops->size : sizeof(ep->engine));
+        ops = &ep->engine;
+        if (!ops->name || (ops->max_batch < 1) || !ops->open || !ops->submit || !ops->reap || !ops->flush ||
+            !ops->close) {
+            fprintf(stderr, "%s leaves part of struct tw_engine unset\n", path);
+            goto fail;
+        }
+    }
+    ep->ops = ops;
+    if ((ep->ctx = ops->open(target, flags, args)) == NULL) {
+        fprintf(stderr, "Engine %s unable to open %s : %s\n", ops->name, target, strerror(errno));
+        goto fail;
+    }
+    return 0;
+fail:
+    if (ep->dl)
+        dlclose(ep->dl);
+    ep->ops = NULL;
+    return -1;
+}
+
+
+/* one io through the engine, write() style: bytes written or -1 with errno set */
+static ssize_t engine_plugin_write(struct engine_plugin *ep, const void *buf, size_t len, off_t offset)
+{
+    struct tw_io *io = &ep->io, *done;
+
+    io->buf = buf;
+    io->len = len;
+    io->offset = (long long) offset;
+    io->res = 0;
+    errno = 0;
+    if ((ep->ops->submit(ep->ctx, &io, 1) != 1) || (ep->ops->reap(ep->ctx, &done, 1, 1) != 1)) {
+        errno = errno ? errno : EIO;
+        return -1;
+    }
+    if (done->res < 0) {
+        errno = (int) -done->res;
+        return -1;
+    }
+    return (ssize_t) done->res;
+}
+
+
+/* flush, report how long that took, close and unload */
+void engine_plugin_close(struct engine_plugin *ep)
+{
+    double t = now_mono();
+
+    if (ep->ops->flush(ep->ctx) == -1)
+        fprintf(stderr, "Engine %s flush failed: %s\n", ep->ops->name, strerror(errno));
+    else
+        printf("Engine %s flush: %.3lf ms\n", ep->ops->name, (now_mono() - t) * 1000);
+    if (ep->ops->close(ep->ctx) == -1)
+        fprintf(stderr, "Engine %s close failed: %s\n", ep->ops->name, strerror(errno));
+    // ops and everything it points to go with the plugin
+    if (ep->dl)
+        dlclose(ep->dl);
+    ep->ops = NULL;
+}
+
+
+/* where -e energy figures are counted from */
+struct energy_mark {
+    double when;
+    double joules[2];                       /* package, core */
+    struct tms times;
+    unsigned long long bytes;
+    unsigned long ops;
+};
+
+
+/*
+    everything a line run carries from one iteration to the next; the
+    loop itself is line_loop(), specialised per mode combination below
+*/
+struct line_state {
+    const struct writer_config *cfg;
+    int fd;                                 /* -1 under -E */
+    struct engine_plugin plugin;
+    void *write_buf;
+    size_t write_buf_size;
+    int failures;
+    int next_iter;
+    int blocksize;                          /* these three can change under -C */
+    double interval;
+    enum lock_mode lock_mode;
+    double pause;
+    off_t offset;
+    struct lat_hist write_hist;
+    struct lat_hist chunk_hist;
+    struct lat_hist fill_hist;
+    struct lat_hist lock_hist;
+    double lock_wait;                       /* of the current iteration under -L */
+    struct chunk_pool pool;
+    struct flusher flusher;
+    struct writebehind wb;
+    struct throughput tp;
+    struct iov_payload ip;
+    struct live_metrics *live;
+    struct dashboard *db;
+    struct flight_recorder *fr;
+    struct adaptive ad;
+    int llc_fd;
+    uint64_t misses;
+    uint64_t fill_misses;
+    uint64_t write_misses;
+    struct tms times_before;
+    struct rapl *rapl;                      /* -e, NULL when off or unavailable */
+    double joules_before[2];                /* package and core at the start of the iteration */
+    unsigned long long energy_bytes;
+    unsigned long energy_ops;
+    struct energy_mark run_mark;
+    struct energy_mark window_mark;
+    int per_second;                         /* keep throughput per second, grows with the run */
+    atomic_int stop;                        /* end the loop at the next iteration */
+    int wake_fd;                            /* eventfd that cuts a sleep short, or -1 */
+    struct control *ctl;
+    struct checkpoint *ck;
+    FILE *trace;                            /* -t, one CSV row per iteration */
+    void (*on_write)(void *arg, ssize_t ws, size_t expected, int _errno, double latency);
+    void *on_write_arg;
+};
+
+typedef int (*line_loop_fn)(struct line_state *st);
+
+
+/* package and core joules from the last sample of st->rapl */
+static void energy_sample(struct line_state *st, double *joules)
+{
+    rapl_sample(st->rapl);
+    joules[0] = rapl_joules(st->rapl, 0);
+    joules[1] = rapl_joules(st->rapl, 1);
+}
+
+
+/* start of a run or of a -C window */
+static void energy_mark(struct line_state *st, struct energy_mark *m)
+{
+    energy_sample(st, m->joules);
+    m->when = now_mono();
+    times(&m->times);
+    m->bytes = st->energy_bytes;
+    m->ops = st->energy_ops;
+}
+
+
+/* energy, power, cost of the work and CPU time since mark M */
+static void energy_format(struct line_state *st, const struct energy_mark *m, char *buf, size_t size)
+{
+    struct tms now_times;
+    double joules[2], package, elapsed;
+    unsigned long long bytes = st->energy_bytes - m->bytes;
+    unsigned long ops = st->energy_ops - m->ops;
+    int n;
+
+    energy_sample(st, joules);
+    times(&now_times);
+    package = joules[0] - m->joules[0];
+    elapsed = now_mono() - m->when;
+    n = snprintf(buf, size, "package %.2lf J (%.2lf W)", package, elapsed > 0 ? package / elapsed : 0);
+    if (joules[1] >= 0)
+        n += snprintf(buf + n, size - n, "; core %.2lf J", joules[1] - m->joules[1]);
+    if (bytes)
+        n += snprintf(buf + n, size - n, "; %.2lf J/GiB", package / ((double) bytes / (1024 * 1024 * 1024)));
+    if (ops)
+        n += snprintf(buf + n, size - n, "; %.6lf J/op", package / ops);
+    snprintf(buf + n, size - n, " (user: %.2lf; sys: %.2lf)",
+        (double) (now_times.tms_utime - m->times.tms_utime) / sysconf(_SC_CLK_TCK),
+        (double) (now_times.tms_stime - m->times.tms_stime) / sysconf(_SC_CLK_TCK));
+}
+
+
+/* what the write histogram is labelled with */
+static const char *line_write_label(const struct line_state *st)
+{
+    if (st->cfg->engine == ENGINE_CHUNKED)
+        return "pwrite()";
+    if (st->cfg->engine == ENGINE_PLUGIN)
+        return st->plugin.ops->name;
+    return "write()";
+}
+
+
+#define LINE_FAILED         1               /* loop gave up after -f consecutive failures */
+#define LINE_RESELECT       2               /* loop returned to switch variants */
+
+
+/* sleep_for(), unless wake_fd is poked first */
+static void line_sleep(struct line_state *st, double seconds)
+{
+    struct pollfd pfd;
+    struct timespec ts;
+
+    if (st->wake_fd == -1) {
+        sleep_for(seconds);
+        return;
+    }
+    if (seconds <= 0)
+        return;
+    pfd.fd = st->wake_fd;
+    pfd.events = POLLIN;
+    ts.tv_sec = (time_t) seconds;
+    ts.tv_nsec = (long) ((seconds - (double) ts.tv_sec) * 1000000000);
+    while ((ppoll(&pfd, 1, &ts, NULL) == -1) && (errno == EINTR))
+        ;
+}
+
+
+/*
+    -C SOCKET: runtime control of a line run.  A thread serves one client
+    at a time on a Unix stream socket, one command per line; the loop
+    applies each command at the next iteration boundary, or right away
+    while it sleeps, and every reply ends with a line starting ok or
+    error.  Extra writers append the same blocks to FILENAME from their
+    own threads, to step load up and down during an investigation.
+*/
+struct control;
+
+struct control_writer {
+    struct control *ctl;
+    pthread_t thread;
+    atomic_int stop;
+};
+
+struct control {
+    const char *path;
+    const char *filename;
+    int listen_fd;
+    int client_fd;
+    int wake_fd;                            /* the loop's, poked when a command is pending */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t done_cv;                 /* command handled */
+    pthread_cond_t writers_cv;              /* parameters changed or writer stopped */
+    char command[CONTROL_LINE_MAX];
+    char reply[CONTROL_REPLY_MAX];
+    size_t reply_len;
+    atomic_int pending;
+    int closing;
+    int paused;
+    // copies of the loop's parameters for the extra writers
+    int blocksize;
+    double pause;
+    enum lock_mode lock_mode;
+    int oflags;
+    struct control_writer *writers[WRITERS_MAX];
+    int nwriters;
+    struct lat_hist writers_hist;
+    unsigned long writers_failures;
+};
+
+
+static void control_reply(struct control *ctl, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(ctl->reply + ctl->reply_len, sizeof(ctl->reply) - ctl->reply_len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        ctl->reply_len += (size_t) n < sizeof(ctl->reply) - ctl->reply_len ?
+            (size_t) n : sizeof(ctl->reply) - ctl->reply_len - 1;
+}
+
+
+/*
+    LOCK_EX for one write of an extra writer.  The main writer may hold
+    the lock for as long as set-lock held lasts, so poll rather than
+    block, and give up once w is told to stop so it can still be joined.
+    0 unless stopped; other flock() failures write unlocked, as before.
+*/
+static int control_writer_lock(struct control_writer *w, int fd)
+{
+    while (flock(fd, LOCK_EX|LOCK_NB) == -1) {
+        if ((errno != EWOULDBLOCK) && (errno != EINTR))
+            return 0;
+        if (atomic_load(&w->stop))
+            return -1;
+        sleep_for(CONTROL_LOCK_POLL_MS / 1000.0);
+    }
+    return 0;
+}
+
+
+static void *control_writer_main(void *arg)
+{
+    struct control_writer *w = arg;
+    struct control *ctl = w->ctl;
+    void *buf = NULL;
+    size_t buf_size = 0, size, write_actual;
+    enum lock_mode lock_mode;
+    struct timespec until;
+    ssize_t ws;
+    double t, pause;
+    int fd, blocksize, seq = 0;
+
+    if ((fd = open(ctl->filename, O_WRONLY|O_APPEND|ctl->oflags)) == -1) {
+        fprintf(stderr, "Extra writer unable to open %s : %s\n", ctl->filename, strerror(errno));
+        return NULL;
+    }
+    while (!atomic_load(&w->stop)) {
+        pthread_mutex_lock(&ctl->lock);
+        while (ctl->paused && !atomic_load(&w->stop))
+            pthread_cond_wait(&ctl->writers_cv, &ctl->lock);
+        blocksize = ctl->blocksize;
+        pause = ctl->pause;
+        lock_mode = ctl->lock_mode;
+        pthread_mutex_unlock(&ctl->lock);
+        if (atomic_load(&w->stop))
+            break;
+
+        size = blocksize > BS_DEF ? (size_t) blocksize : (size_t) BS_DEF;
+        if (size > buf_size) {
+            free(buf);
+            if ((buf = malloc(size)) == NULL)
+                break;
+            memset(buf, '\r', size);
+            buf_size = size;
+        }
+        if ((lock_mode == LOCKMODE_WRITE) && (control_writer_lock(w, fd) == -1))
+            break;
+        write_actual = payload_header(buf, seq++, blocksize);
+        t = now_mono();
+        ws = write(fd, buf, write_actual);
+        t = now_mono() - t;
+        if (lock_mode == LOCKMODE_WRITE)
+            flock(fd, LOCK_UN);
+
+        pthread_mutex_lock(&ctl->lock);
+        if (ws == (ssize_t) write_actual)
+            hist_record(&ctl->writers_hist, t);
+        else
+            ctl->writers_failures++;
+        if (pause > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            until.tv_sec += (time_t) pause;
+            until.tv_nsec += (long) ((pause - (double) (time_t) pause) * 1000000000);
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            while (!atomic_load(&w->stop) &&
+                (pthread_cond_timedwait(&ctl->writers_cv, &ctl->lock, &until) != ETIMEDOUT))
+                ;
+        }
+        pthread_mutex_unlock(&ctl->lock);
+    }
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+
+/* control lock held */
+static void control_add_writer(struct control *ctl)
+{
+    struct control_writer *w = calloc(1, sizeof(*w));
+
+    w->ctl = ctl;
+    atomic_init(&w->stop, 0);
+    if (pthread_create(&w->thread, NULL, control_writer_main, w) != 0) {
+        free(w);
+        control_reply(ctl, "error unable to start writer\n");
+        return;
+    }
+    ctl->writers[ctl->nwriters++] = w;
+}
+
+
+/* control lock held, dropped while joining so the writer can finish its sleep */
+static void control_remove_writer(struct control *ctl)
+{
+    struct control_writer *w = ctl->writers[--ctl->nwriters];
+
+    atomic_store(&w->stop, 1);
+    pthread_cond_broadcast(&ctl->writers_cv);
+    pthread_mutex_unlock(&ctl->lock);
+    pthread_join(w->thread, NULL);
+    pthread_mutex_lock(&ctl->lock);
+    free(w);
+}
+
+
+static const char *lock_mode_names[LOCKMODES] = { "none", "held", "write" };
+
+
+/* run the pending command in the loop's thread, between iterations */
+static void control_apply(struct line_state *st, int iter)
+{
+    struct control *ctl = st->ctl;
+    char *cmd, *arg, *save;
+    char line[HIST_LINE_MAX];
+    long v;
+    int n, flags;
+
+    pthread_mutex_lock(&ctl->lock);
+    ctl->reply_len = 0;
+    ctl->reply[0] = '\0';
+    cmd = strtok_r(ctl->command, " \t", &save);
+    arg = strtok_r(NULL, " \t", &save);
+    if (!cmd)
+        control_reply(ctl, "error empty command\n");
+    else if (strcmp(cmd, "set-rate") == 0) {
+        // writes per second, or max for back to back
+        double rate = arg ? atof(arg) : 0;
+
+        if (arg && (strcmp(arg, "max") == 0))
+            st->interval = 0;
+        else if ((rate > 0) && (1 / rate <= INTERVAL_MAX))
+            st->interval = 1 / rate;
+        else {
+            control_reply(ctl, "error expecting set-rate WRITES_PER_SECOND|max\n");
+            goto out;
+        }
+        st->pause = st->interval;
+        ctl->pause = st->interval;
+        control_reply(ctl, "ok interval %.6lf s\n", st->interval);
+    } else if (strcmp(cmd, "set-bs") == 0) {
+        long max = st->cfg->payload == PAYLOAD_IOV ? (long) BS_MAX_IOV : (long) BS_MAX;
+        size_t size;
+
+        v = arg ? atol(arg) : -1;
+        if ((v < 0) || (v > max) || ((v == 0) && (strcmp(arg, "0") != 0))) {
+            control_reply(ctl, "error expecting set-bs BYTES <= %ld\n", max);
+            goto out;
+        }
+        if (st->cfg->payload == PAYLOAD_IOV) {
+            struct iov_payload ip;
+
+            if (iov_payload_init(&ip, (size_t) v) == -1) {
+                control_reply(ctl, "error unable to allocate %ld byte iovec payload\n", v);
+                goto out;
+            }
+            iov_payload_free(&st->ip);
+            st->ip = ip;
+        } else if ((size = v > BS_DEF ? (size_t) v : (size_t) BS_DEF) > st->write_buf_size) {
+            void *buf = malloc(size);
+
+            if (!buf) {
+                control_reply(ctl, "error unable to allocate %ld bytes\n", v);
+                goto out;
+            }
+            memset(buf, '\r', size);
+            free(st->write_buf);
+            st->write_buf = buf;
+            st->write_buf_size = size;
+        }
+        st->blocksize = (int) v;
+        ctl->blocksize = (int) v;
+        control_reply(ctl, "ok blocksize %d\n", st->blocksize);
+    } else if (strcmp(cmd, "set-lock") == 0) {
+        enum lock_mode mode = LOCKMODES;
+
+        for (int i = 0; arg && (i < LOCKMODES); i++)
+            if (strcmp(arg, lock_mode_names[i]) == 0)
+                mode = (enum lock_mode) i;
+        if (mode == LOCKMODES) {
+            control_reply(ctl, "error expecting set-lock none|held|write\n");
+            goto out;
+        }
+        if (st->fd == -1) {
+            control_reply(ctl, "error no file to lock under -E\n");
+            goto out;
+        }
+        if ((mode == LOCKMODE_HELD) && (st->lock_mode != LOCKMODE_HELD) && (flock(st->fd, LOCK_EX) == -1)) {
+            control_reply(ctl, "error flock() returned %d (%s)\n", errno, strerror(errno));
+            goto out;
+        }
+        if ((mode != LOCKMODE_HELD) && (st->lock_mode == LOCKMODE_HELD))
+            flock(st->fd, LOCK_UN);
+        st->lock_mode = mode;
+        ctl->lock_mode = mode;
+        control_reply(ctl, "ok lock %s\n", lock_mode_names[mode]);
+    } else if (strcmp(cmd, "pause") == 0) {
+        ctl->paused = 1;
+        control_reply(ctl, "ok paused\n");
+    } else if (strcmp(cmd, "resume") == 0) {
+        ctl->paused = 0;
+        control_reply(ctl, "ok resumed\n");
+    } else if (strcmp(cmd, "snapshot") == 0) {
+        control_reply(ctl, "iteration %d\n", iter);
+        control_reply(ctl, "paused %s\n", ctl->paused ? "yes" : "no");
+        control_reply(ctl, "interval %.6lf s\n", st->interval);
+        control_reply(ctl, "blocksize %d\n", st->blocksize);
+        control_reply(ctl, "lock %s\n", lock_mode_names[st->lock_mode]);
+        control_reply(ctl, "writers %d\n", 1 + ctl->nwriters);
+        control_reply(ctl, "consecutive failures %d\n", st->failures);
+        hist_format(line, sizeof(line), line_write_label(st), &st->write_hist);
+        control_reply(ctl, "%s", line);
+        if (st->lock_hist.count) {
+            hist_format(line, sizeof(line), "lock wait", &st->lock_hist);
+            control_reply(ctl, "%s", line);
+        }
+        if (ctl->nwriters || ctl->writers_hist.count) {
+            hist_format(line, sizeof(line), "extra writers", &ctl->writers_hist);
+            control_reply(ctl, "%s", line);
+            control_reply(ctl, "extra writer failures %lu\n", ctl->writers_failures);
+        }
+        if (st->rapl) {
+            energy_format(st, &st->window_mark, line, sizeof(line));
+            control_reply(ctl, "energy %s\n", line);
+        }
+        control_reply(ctl, "ok\n");
+    } else if (strcmp(cmd, "reset-window") == 0) {
+        hist_init(&st->write_hist);
+        hist_init(&st->chunk_hist);
+        hist_init(&st->lock_hist);
+        hist_init(&ctl->writers_hist);
+        ctl->writers_failures = 0;
+        if (st->rapl)
+            energy_mark(st, &st->window_mark);
+        control_reply(ctl, "ok window reset at iteration %d\n", iter);
+    } else if ((strcmp(cmd, "add-writers") == 0) || (strcmp(cmd, "remove-writers") == 0)) {
+        int add = cmd[0] == 'a';
+
+        v = arg ? atol(arg) : 1;
+        if ((v <= 0) || (add && (ctl->nwriters + v > WRITERS_MAX)) || (!add && (v > ctl->nwriters))) {
+            control_reply(ctl, "error %d extra writers running, at most %d\n", ctl->nwriters, WRITERS_MAX);
+            goto out;
+        }
+        if (add && (st->cfg->engine != ENGINE_WRITE)) {
+            control_reply(ctl, "error extra writers need the write() engine, not -j or -E\n");
+            goto out;
+        }
+        for (n = 0; n < v; n++) {
+            if (add)
+                control_add_writer(ctl);
+            else
+                control_remove_writer(ctl);
+        }
+        /*
+            the extra writers append, so the main writer does too while any
+            are running, or its own file position lands on their blocks
+        */
+        if ((flags = fcntl(st->fd, F_GETFL)) != -1) {
+            if (!ctl->nwriters)
+                lseek(st->fd, 0, SEEK_END);
+            fcntl(st->fd, F_SETFL, ctl->nwriters ? flags | O_APPEND : flags & ~O_APPEND);
+        }
+        control_reply(ctl, "ok %d extra writers\n", ctl->nwriters);
+    } else if (strcmp(cmd, "help") == 0)
+        control_reply(ctl, "ok commands: set-rate WRITES_PER_SECOND|max, set-bs BYTES, "
+            "set-lock none|held|write, pause, resume, snapshot, reset-window, "
+            "add-writers [N], remove-writers [N], quit\n");
+    else
+        control_reply(ctl, "error unknown command %s, try help\n", cmd);
+out:
+    atomic_store(&ctl->pending, 0);
+    pthread_cond_broadcast(&ctl->done_cv);
+    pthread_cond_broadcast(&ctl->writers_cv);
+    pthread_mutex_unlock(&ctl->lock);
+}
+
+
+static void *control_main(void *arg)
+{
+    struct control *ctl = arg;
+    char line[CONTROL_LINE_MAX], reply[CONTROL_REPLY_MAX];
+    uint64_t one = 1;
+    FILE *in;
+    int fd;
+
+    for (;;) {
+        if ((fd = accept4(ctl->listen_fd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+            if ((errno == EINTR) || (errno == ECONNABORTED))
+                continue;
+            break;
+        }
+        pthread_mutex_lock(&ctl->lock);
+        ctl->client_fd = ctl->closing ? -1 : fd;
+        pthread_mutex_unlock(&ctl->lock);
+        if ((ctl->client_fd == -1) || ((in = fdopen(fd, "r")) == NULL)) {
+            close(fd);
+            break;
+        }
+        while (fgets(line, sizeof(line), in)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+                continue;
+            if (strcmp(line, "quit") == 0)
+                break;
+            pthread_mutex_lock(&ctl->lock);
+            if (!ctl->closing) {
+                snprintf(ctl->command, sizeof(ctl->command), "%s", line);
+                atomic_store(&ctl->pending, 1);
+                if (write(ctl->wake_fd, &one, sizeof(one)) == -1) {
+                    // already poked, the loop will see pending
+                }
+                while (atomic_load(&ctl->pending) && !ctl->closing)
+                    pthread_cond_wait(&ctl->done_cv, &ctl->lock);
+            }
+            snprintf(reply, sizeof(reply), "%s", atomic_load(&ctl->pending) || ctl->closing ?
+                "error run finished\n" : ctl->reply);
+            pthread_mutex_unlock(&ctl->lock);
+            if (write(fd, reply, strlen(reply)) == -1)
+                break;
+        }
+        pthread_mutex_lock(&ctl->lock);
+        ctl->client_fd = -1;
+        pthread_mutex_unlock(&ctl->lock);
+        fclose(in);
+    }
+    return NULL;
+}
+
+
+int control_start(struct line_state *st, const char *path)
+{
+    struct control *ctl;
+    struct sockaddr_un addr;
+    pthread_condattr_t attr;
+    struct stat sb;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Control socket path too long: %s\n", path);
+        return -1;
+    }
+    ctl = calloc(1, sizeof(*ctl));
+    ctl->path = path;
+    ctl->filename = st->cfg->filename;
+    ctl->client_fd = -1;
+    ctl->wake_fd = st->wake_fd;
+    ctl->blocksize = st->blocksize;
+    ctl->pause = st->interval;
+    ctl->lock_mode = st->lock_mode;
+    ctl->oflags = st->cfg->durability == DURABILITY_OSYNC ? O_SYNC : 0;
+    atomic_init(&ctl->pending, 0);
+    hist_init(&ctl->writers_hist);
+    pthread_mutex_init(&ctl->lock, NULL);
+    pthread_cond_init(&ctl->done_cv, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ctl->writers_cv, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // a socket left behind by an earlier run is replaced, anything else is not
+    if ((lstat(path, &sb) == 0) && S_ISSOCK(sb.st_mode))
+        unlink(path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (((ctl->listen_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1) ||
+        (bind(ctl->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) ||
+        (listen(ctl->listen_fd, 4) == -1) ||
+        (pthread_create(&ctl->thread, NULL, control_main, ctl) != 0)) {
+        fprintf(stderr, "Unable to serve control socket %s : %s\n", path, strerror(errno));
+        if (ctl->listen_fd != -1)
+            close(ctl->listen_fd);
+        free(ctl);
+        return -1;
+    }
+    st->ctl = ctl;
+    printf("Control socket: %s\n", path);
+    return 0;
+}
+
+
+void control_stop(struct line_state *st)
+{
+    struct control *ctl = st->ctl;
+
+    pthread_mutex_lock(&ctl->lock);
+    ctl->closing = 1;
+    ctl->paused = 0;
+    pthread_cond_broadcast(&ctl->done_cv);
+    if (ctl->client_fd != -1)
+        shutdown(ctl->client_fd, SHUT_RDWR);
+    while (ctl->nwriters)
+        control_remove_writer(ctl);
+    pthread_mutex_unlock(&ctl->lock);
+    shutdown(ctl->listen_fd, SHUT_RDWR);
+    pthread_join(ctl->thread, NULL);
+    close(ctl->listen_fd);
+    unlink(ctl->path);
+    if (ctl->writers_hist.count)
+        hist_print("extra writers", &ctl->writers_hist);
+    pthread_mutex_destroy(&ctl->lock);
+    pthread_cond_destroy(&ctl->done_cv);
+    pthread_cond_destroy(&ctl->writers_cv);
+    free(ctl);
+    st->ctl = NULL;
+}
+
+
+/*
+    The sleep between iterations of a controlled run: commands are applied
+    as they arrive, set-rate moves the end of the current sleep and pause
+    holds the loop here.  Returns 1 when the lock mode changed, so the
+    caller switches to the matching loop variant.
+*/
+static __attribute__((noinline)) int control_wait(struct line_state *st, int iter)
+{
+    struct control *ctl = st->ctl;
+    enum lock_mode lock_mode = st->lock_mode;
+    double start = now_mono(), left;
+    struct pollfd pfd;
+    struct timespec ts;
+    uint64_t drain;
+
+    pfd.fd = st->wake_fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        if (atomic_load(&ctl->pending))
+            control_apply(st, iter);
+        if (atomic_load_explicit(&st->stop, memory_order_relaxed))
+            break;
+        left = start + st->pause - now_mono();
+        if (!ctl->paused && (left <= 0))
+            break;
+        if (left < 0)
+            left = 0;
+        ts.tv_sec = (time_t) left;
+        ts.tv_nsec = (long) ((left - (double) ts.tv_sec) * 1000000000);
+        if ((ppoll(&pfd, 1, ctl->paused ? NULL : &ts, NULL) > 0) &&
+            (read(st->wake_fd, &drain, sizeof(drain)) == -1)) {
+            // drained by an earlier read
+        }
+    }
+    return st->lock_mode != lock_mode;
+}
+
+
+/*
+    -k SECONDS: checkpoint a line run's sequence, offset and histograms to
+    FILENAME.checkpoint, and -r to resume from it.  Each checkpoint is
+    written to a temporary file, fsync()ed and renamed over the last, so a
+    crash leaves one whole checkpoint or the other.  Writes made after the
+    last checkpoint stay in FILENAME but not in the stats, and a resumed
+    run writes their sequence numbers again.
+*/
+struct checkpoint {
+    char path[PATH_MAX];
+    double period;
+    double due;
+    double started;                         /* CLOCK_REALTIME the first run started */
+    int resumes;
+};
+
+
+static void checkpoint_hist(FILE *f, const char *name, const struct lat_hist *h)
+{
+    fprintf(f, "hist %s %lu %.9lf %.9lf %.9lf\n", name, h->count, h->sum, h->min, h->max);
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        if (h->bucket[i])
+            fprintf(f, "bucket %s %d %lu\n", name, i, h->bucket[i]);
+}
+
+
+static struct lat_hist *checkpoint_hist_named(struct line_state *st, const char *name)
+{
+    if (strcmp(name, "write") == 0)
+        return &st->write_hist;
+    if (strcmp(name, "chunk") == 0)
+        return &st->chunk_hist;
+    if (strcmp(name, "lock") == 0)
+        return &st->lock_hist;
+    if (strcmp(name, "fill") == 0)
+        return &st->fill_hist;
+    return NULL;
+}
+
+
+int checkpoint_write(struct line_state *st, int next_iter)
+{
+    struct checkpoint *ck = st->ck;
+    char tmp[PATH_MAX + 8], dir[PATH_MAX];
+    off_t offset;
+    FILE *f;
+    int fd;
+
+    offset = (st->cfg->engine == ENGINE_CHUNKED) || (st->cfg->engine == ENGINE_PLUGIN) ?
+        st->offset : lseek(st->fd, 0, SEEK_CUR);
+    // the offset must not claim more of FILENAME than survives a crash
+    if ((st->cfg->engine == ENGINE_PLUGIN ? st->plugin.ops->flush(st->plugin.ctx) : fsync(st->fd)) == -1) {
+        fprintf(stderr, "Unable to checkpoint, flushing %s failed : %s\n", st->cfg->filename, strerror(errno));
+        return -1;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ck->path);
+    if ((f = fopen(tmp, "w")) == NULL) {
+        fprintf(stderr, "Unable to write checkpoint %s : %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    fprintf(f, "timed-writer checkpoint %d\n", CHECKPOINT_VERSION);
+    fprintf(f, "buckets %d\n", HIST_BUCKETS);
+    fprintf(f, "blocksize %d\n", st->blocksize);
+    fprintf(f, "next_iter %d\n", next_iter);
+    fprintf(f, "offset %lld\n", (long long) offset);
+    fprintf(f, "started %.6lf\n", ck->started);
+    fprintf(f, "saved %.6lf\n", now_real());
+    fprintf(f, "resumes %d\n", ck->resumes);
+    checkpoint_hist(f, "write", &st->write_hist);
+    checkpoint_hist(f, "chunk", &st->chunk_hist);
+    checkpoint_hist(f, "lock", &st->lock_hist);
+    checkpoint_hist(f, "fill", &st->fill_hist);
+    if ((fflush(f) == EOF) || (fsync(fileno(f)) == -1)) {
+        fprintf(stderr, "Unable to write checkpoint %s : %s\n", tmp, strerror(errno));
+        fclose(f);
+        unlink(tmp);
+        return -1;
+    }
+    fclose(f);
+    if (rename(tmp, ck->path) == -1) {
+        fprintf(stderr, "Unable to rename checkpoint to %s : %s\n", ck->path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    // the rename is only durable once the directory is
+    snprintf(dir, sizeof(dir), "%s", ck->path);
+    if ((fd = open(dirname(dir), O_RDONLY|O_DIRECTORY)) != -1) {
+        fsync(fd);
+        close(fd);
+    }
+    return 0;
+}
+
+
+/* merge the checkpoint's stats into st, returns its file offset or -1 */
+static off_t checkpoint_load(struct line_state *st)
+{
+    struct checkpoint *ck = st->ck;
+    struct lat_hist *h;
+    char line[256], key[32], name[16];
+    long long offset = -1;
+    unsigned long n;
+    double saved = 0;
+    int version = 0, v, i;
+    FILE *f;
+
+    if ((f = fopen(ck->path, "r")) == NULL) {
+        fprintf(stderr, "Unable to resume from %s : %s\n", ck->path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%31s", key) != 1)
+            continue;
+        if (strcmp(key, "timed-writer") == 0)
+            sscanf(line, "timed-writer checkpoint %d", &version);
+        else if ((strcmp(key, "buckets") == 0) && (sscanf(line, "buckets %d", &v) == 1) && (v != HIST_BUCKETS))
+            version = -1;
+        else if ((strcmp(key, "blocksize") == 0) && (sscanf(line, "blocksize %d", &v) == 1) &&
+            (v != st->blocksize))
+            printf("Warning: checkpoint was taken with write size %d\n", v);
+        else if (strcmp(key, "next_iter") == 0)
+            sscanf(line, "next_iter %d", &st->next_iter);
+        else if (strcmp(key, "offset") == 0)
+            sscanf(line, "offset %lld", &offset);
+        else if (strcmp(key, "started") == 0)
+            sscanf(line, "started %lf", &ck->started);
+        else if (strcmp(key, "saved") == 0)
+            sscanf(line, "saved %lf", &saved);
+        else if (strcmp(key, "resumes") == 0)
+            sscanf(line, "resumes %d", &ck->resumes);
+        else if (strcmp(key, "hist") == 0) {
+            struct lat_hist saved_hist;
+
+            hist_init(&saved_hist);
+            if ((sscanf(line, "hist %15s %lu %lf %lf %lf", name, &saved_hist.count, &saved_hist.sum,
+                    &saved_hist.min, &saved_hist.max) == 5) &&
+                ((h = checkpoint_hist_named(st, name)) != NULL))
+                hist_merge(h, &saved_hist);
+        } else if ((strcmp(key, "bucket") == 0) &&
+            (sscanf(line, "bucket %15s %d %lu", name, &i, &n) == 3) &&
+            ((h = checkpoint_hist_named(st, name)) != NULL) && (i >= 0) && (i < HIST_BUCKETS))
+            h->bucket[i] += n;
+    }
+    fclose(f);
+    if ((version != CHECKPOINT_VERSION) || (offset < 0) || (st->next_iter < 0) ||
+        (st->next_iter > st->cfg->iterations)) {
+        fprintf(stderr, "%s is not a checkpoint this version can resume from\n", ck->path);
+        return -1;
+    }
+    ck->resumes++;
+    format_real(line, sizeof(line), saved);
+    printf("Resuming from checkpoint of %s: sequence %d, offset %lld, %lu writes so far\n",
+        line,
+        st->next_iter,
+        offset,
+        st->write_hist.count);
+    return (off_t) offset;
+}
+
+
+/* per-iteration output and hooks, kept out of line so the quiet variants stay small */
+static __attribute__((noinline)) void line_observe(struct line_state *st,
+                                                    int iter,
+                                                    ssize_t ws,
+                                                    size_t expected,
+                                                    int _errno,
+                                                    double latency,
+                                                    double single_latency)
+{
+    const struct writer_config *cfg = st->cfg;
+    struct tms times_after;
+    struct flight_record rec;
+    double user_times_delta;
+    double sys_times_delta;
+    double joules[2];
+    char energy[64] = "";
+
+    times(&times_after);
+    if (st->rapl) {
+        energy_sample(st, joules);
+        st->energy_ops++;
+        st->energy_bytes += ws > 0 ? (size_t) ws : 0;
+        if (joules[1] >= 0)
+            snprintf(energy, sizeof(energy), "; package: %.3lf J; core: %.3lf J",
+                joules[0] - st->joules_before[0],
+                joules[1] - st->joules_before[1]);
+        else
+            snprintf(energy, sizeof(energy), "; package: %.3lf J", joules[0] - st->joules_before[0]);
+    }
+    st->write_misses += perf_counter_read(st->llc_fd) - st->misses;
+    user_times_delta =
+        ((double) (times_after.tms_utime - st->times_before.tms_utime) / sysconf(_SC_CLK_TCK));
+    sys_times_delta =
+        ((double) (times_after.tms_stime - st->times_before.tms_stime) / sysconf(_SC_CLK_TCK));
+    if (st->live)
+        live_metrics_record(st->live, latency, ws > 0 ? (size_t) ws : 0, ws != -1,
+            st->lock_mode == LOCKMODE_WRITE ? st->lock_wait : -1);
+    if (st->on_write)
+        st->on_write(st->on_write_arg, ws, expected, _errno, latency);
+    if (st->trace)
+        fprintf(st->trace, "%.6lf,%d,%d,%zd,%.9lf\n", now_real(), iter, ws == -1 ? _errno : 0, ws, latency);
+    if (st->ck && (now_mono() >= st->ck->due)) {
+        checkpoint_write(st, iter + 1);
+        st->ck->due = now_mono() + st->ck->period;
+    }
+    if (st->fr) {
+        memset(&rec, 0, sizeof(rec));
+        rec.when = now_real();
+        rec.seq = iter;
+        rec.err = ws == -1 ? _errno : 0;
+        rec.bytes = ws > 0 ? (size_t) ws : 0;
+        rec.latency = latency;
+        rec.user = user_times_delta;
+        rec.sys = sys_times_delta;
+        flight_recorder_push(st->fr, &rec);
+    }
+    if (!cfg->quiet) {
+        if (cfg->chunks > 1)
+            printf("pwrite() took approx %.6lf seconds; %d chunks took approx %.6lf seconds\n",
+                single_latency,
+                cfg->chunks,
+                latency);
+        else
+            printf("write() took approx %.2lf seconds (user: %.2lf; sys: %.2lf%s)\n",
+                latency,
+                user_times_delta,
+                sys_times_delta,
+                energy);
+    }
+    if (cfg->adapt_threshold_ms)
+        st->pause = adaptive_note(&st->ad, now_real() - latency, latency, ws != -1, st->interval);
+}
+
+
+/*
+    The loop of a line run.  Callers pass compile time constants for
+    engine, lock mode, durability, payload and observe, and always_inline
+    lets the compiler drop every branch that doesn't apply, so adding a
+    mode adds variants rather than tests on the hot path.
+*/
+static inline __attribute__((always_inline)) int line_loop(struct line_state *st,
+                                                           const enum engine engine,
+                                                           const enum lock_mode lock_mode,
+                                                           const enum durability durability,
+                                                           const enum payload payload,
+                                                           const int observe)
+{
+    const struct writer_config *cfg = st->cfg;
+    size_t write_actual;
+    ssize_t ws;
+    double t, latency, single_latency = 0;
+    int _errno = 0;
+
+    for (int iter = st->next_iter; (iter < cfg->iterations) && !atomic_load_explicit(&st->stop, memory_order_relaxed);) {
+        if (observe)
+            st->misses = perf_counter_read(st->llc_fd);
+        if ((payload == PAYLOAD_REGEN) || (payload == PAYLOAD_REGEN_NT)) {
+            t = now_mono();
+            if (payload == PAYLOAD_REGEN) {
+                payload_fill_scalar(st->write_buf, st->write_buf_size, iter);
+                write_actual = payload_header(st->write_buf, iter, st->blocksize);
+            } else {
+                payload_fill_nt(st->write_buf, st->write_buf_size, iter);
+                write_actual = payload_header_nt(st->write_buf, iter, st->blocksize);
+            }
+            hist_record(&st->fill_hist, now_mono() - t);
+            if (observe) {
+                st->fill_misses += perf_counter_read(st->llc_fd) - st->misses;
+                st->misses = perf_counter_read(st->llc_fd);
+            }
+        } else
+            write_actual = payload_header(payload == PAYLOAD_IOV ? st->ip.head : st->write_buf,
+                iter, st->blocksize);
+        if (observe) {
+            if (!cfg->quiet)
+                printf("\nWriting sequence %d (%zu bytes)\n", iter, write_actual);
+            times(&st->times_before);
+            if (st->rapl)
+                energy_sample(st, st->joules_before);
+        }
+
+        if (lock_mode == LOCKMODE_WRITE) {
+            t = now_mono();
+            if (flock(st->fd, LOCK_EX) == -1)
+                run_notice(stderr, "flock() failed with errno %d (%s)", errno, strerror(errno));
+            st->lock_wait = now_mono() - t;
+            hist_record(&st->lock_hist, st->lock_wait);
+        }
+        t = now_mono();
+        if (engine == ENGINE_CHUNKED) {
+            off_t before = st->offset;
+
+            _errno = chunk_compare(&st->pool, st->fd, st->write_buf, write_actual, iter, &st->offset,
+                &st->write_hist, &st->chunk_hist, &single_latency, &latency);
+            ws = _errno ? -1 : (ssize_t) (st->offset - before);
+        } else {
+            if (engine == ENGINE_NULL)
+                ws = (ssize_t) write_actual;
+            else if (engine == ENGINE_PLUGIN) {
+                if ((ws = engine_plugin_write(&st->plugin, st->write_buf, write_actual, st->offset)) > 0)
+                    st->offset += ws;
+            }
+            else if (payload == PAYLOAD_IOV)
+                ws = iov_payload_write(&st->ip, st->fd, write_actual);
+            else
+                ws = write(st->fd, st->write_buf, write_actual);
+            _errno = errno;
+            latency = now_mono() - t;
+        }
+        if (lock_mode == LOCKMODE_WRITE)
+            flock(st->fd, LOCK_UN);
+
+        if (ws == -1) {
+            if (engine != ENGINE_CHUNKED)
+                run_notice(stderr, "write() failed with errno %d (%s)",
+                    _errno,
+                    strerror(_errno));
+            if (cfg->failmax > 0) {
+                st->failures++;
+                if (st->failures == cfg->failmax) {
+                    // out through line_teardown(), which gives the terminal back and removes -M
+                    run_notice(stderr, "Reached max failcount ... bye!");
+                    st->next_iter = iter;
+                    return LINE_FAILED;
+                }
+            }
+        } else
+            st->failures = 0;
+        if (ws > 0) {
+            if (st->per_second)
+                throughput_add(&st->tp, (unsigned long long) ws);
+            // nothing reached the file under the null engine, don't flush or sync_file_range() it
+            if ((durability == DURABILITY_DEFERRED) && (engine != ENGINE_NULL))
+                flusher_note_write(&st->flusher, iter, (size_t) ws);
+            else if ((durability == DURABILITY_WRITEBEHIND) && (engine != ENGINE_NULL))
+                writebehind_note_write(&st->wb, (size_t) ws);
+        }
+        if (engine != ENGINE_CHUNKED) {
+            if (ws == (ssize_t) write_actual)
+                hist_record(&st->write_hist, latency);
+            else if (ws != -1)
+                printf("write() returned %d instead of %d. Interrupted?!!\n", (int) ws, (int) write_actual);
+        }
+        if (observe)
+            line_observe(st, iter, ws, write_actual, _errno, latency, single_latency);
+        if (++iter < cfg->iterations) {
+            if (observe && st->ctl) {
+                if (control_wait(st, iter)) {
+                    st->next_iter = iter;
+                    return LINE_RESELECT;
+                }
+            } else
+                line_sleep(st, st->pause);
+        }
+        st->next_iter = iter;
+    }
+    return 0;
+}
+
+
+#define LINE_VARIANT_NAME(e, l, d, p, o)    line_loop_##e##_##l##_##d##_##p##_##o
+
+#define LINE_VARIANT(e, l, d, p, o) \
+    static int LINE_VARIANT_NAME(e, l, d, p, o)(struct line_state *st) \
+    { \
+        return line_loop(st, e, l, d, p, o); \
+    }
+
+#define LINE_VARIANT_ENTRY(e, l, d, p, o) \
+    [e][l][d][p][o] = LINE_VARIANT_NAME(e, l, d, p, o),
+
+#define LINE_BY_OBSERVE(X, e, l, d, p) \
+    X(e, l, d, p, 0) \
+    X(e, l, d, p, 1)
+#define LINE_BY_PAYLOAD(X, e, l, d) \
+    LINE_BY_OBSERVE(X, e, l, d, PAYLOAD_BUF) \
+    LINE_BY_OBSERVE(X, e, l, d, PAYLOAD_IOV) \
+    LINE_BY_OBSERVE(X, e, l, d, PAYLOAD_REGEN) \
+    LINE_BY_OBSERVE(X, e, l, d, PAYLOAD_REGEN_NT)
+#define LINE_BY_DURABILITY(X, e, l) \
+    LINE_BY_PAYLOAD(X, e, l, DURABILITY_OSYNC) \
+    LINE_BY_PAYLOAD(X, e, l, DURABILITY_NONE) \
+    LINE_BY_PAYLOAD(X, e, l, DURABILITY_DEFERRED) \
+    LINE_BY_PAYLOAD(X, e, l, DURABILITY_WRITEBEHIND)
+#define LINE_BY_LOCK(X, e) \
+    LINE_BY_DURABILITY(X, e, LOCKMODE_NONE) \
+    LINE_BY_DURABILITY(X, e, LOCKMODE_HELD) \
+    LINE_BY_DURABILITY(X, e, LOCKMODE_WRITE)
+#define LINE_VARIANTS(X) \
+    LINE_BY_LOCK(X, ENGINE_WRITE) \
+    LINE_BY_LOCK(X, ENGINE_CHUNKED) \
+    LINE_BY_LOCK(X, ENGINE_NULL) \
+    LINE_BY_LOCK(X, ENGINE_PLUGIN)
+
+LINE_VARIANTS(LINE_VARIANT)
+
+static const line_loop_fn line_loops[ENGINES][LOCKMODES][DURABILITIES][PAYLOADS][2] = {
+    LINE_VARIANTS(LINE_VARIANT_ENTRY)
+};
+
+
+/* any per-iteration output or hook enabled */
+static int line_observed(const struct line_state *st)
+{
+    return !st->cfg->quiet || st->live || st->fr || st->cfg->adapt_threshold_ms || (st->llc_fd != -1) ||
+        st->on_write || st->ctl || st->ck || st->trace || st->rapl;
+}
+
+
+/* the same loop with every mode decided at run time, for comparison */
+static __attribute__((noinline)) int line_loop_generic(struct line_state *st)
+{
+    const struct writer_config *cfg = st->cfg;
+
+    return line_loop(st, cfg->engine, st->lock_mode, cfg->durability, cfg->payload, line_observed(st));
+}
+
+
+line_loop_fn line_loop_select(const struct line_state *st)
+{
+    const struct writer_config *cfg = st->cfg;
+
+    return line_loops[cfg->engine][st->lock_mode][cfg->durability][cfg->payload][line_observed(st)];
+}
+
+
+/* open FILENAME and start whatever the configured modes need */
+int line_setup(struct line_state *st, const struct writer_config *cfg)
+{
+    off_t resume_offset = 0, end;
+    int _errno;
+
+    memset(st, 0, sizeof(*st));
+    st->cfg = cfg;
+    st->fd = -1;
+    st->llc_fd = -1;
+    st->wake_fd = -1;
+    atomic_init(&st->stop, 0);
+    st->interval = cfg->interval;
+    st->pause = cfg->interval;
+    st->blocksize = cfg->blocksize;
+    st->lock_mode = cfg->lock_mode;
+    st->write_buf_size = cfg->blocksize > BS_DEF ? (size_t) cfg->blocksize : (size_t) BS_DEF;
+    if (cfg->payload == PAYLOAD_IOV)
+        st->write_buf_size = (size_t) BS_DEF;
+
+    st->write_buf = malloc(st->write_buf_size);
+    memset(st->write_buf, '\r', st->write_buf_size);
+    hist_init(&st->write_hist);
+    hist_init(&st->chunk_hist);
+    hist_init(&st->fill_hist);
+    hist_init(&st->lock_hist);
+    if (cfg->live_name) {
+        if ((st->live = live_metrics_create(cfg->live_name, cfg->blocksize)) == NULL) {
+            _errno = errno;
+            fprintf(stderr, "Unable to publish live metrics as %s : %d (%s)\n",
+                cfg->live_name,
+                _errno,
+                strerror(_errno));
+            return 1;
+        }
+        printf("Live metrics: /timed-writer.%s\n", cfg->live_name);
+    } else if (cfg->dashboard && ((st->live = live_metrics_create(NULL, cfg->blocksize)) == NULL)) {
+        fprintf(stderr, "Unable to allocate live metrics : %s\n", strerror(errno));
+        return 1;
+    }
+    if (cfg->adapt_threshold_ms) {
+        adaptive_init(&st->ad, cfg->adapt_threshold_ms, cfg->adapt_burst_ms);
+        printf("Adaptive sampling: every %d ms above %d ms or on failure\n",
+            cfg->adapt_burst_ms,
+            cfg->adapt_threshold_ms);
+    }
+    if (cfg->flight_window) {
+        st->fr = malloc(sizeof(*st->fr));
+        flight_recorder_init(st->fr, cfg->flight_window, cfg->flight_after);
+        printf("Flight recorder: last %d s, %d s after a trigger\n", cfg->flight_window, cfg->flight_after);
+    }
+    if ((cfg->payload == PAYLOAD_REGEN) || (cfg->payload == PAYLOAD_REGEN_NT)) {
+        printf("Payload: regenerated each iteration with %s stores\n",
+            cfg->payload == PAYLOAD_REGEN_NT ? "non-temporal" : "regular");
+        if ((st->llc_fd = perf_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES)) == -1)
+            printf("LLC misses: unavailable, perf_event_open() returned %d (%s)\n", errno, strerror(errno));
+    }
+    if ((cfg->payload == PAYLOAD_IOV) && (iov_payload_init(&st->ip, (size_t) cfg->blocksize) == -1)) {
+        fprintf(stderr, "Unable to allocate iovec payload\n");
+        return 1;
+    }
+    if ((cfg->engine == ENGINE_CHUNKED) && (chunk_pool_init(&st->pool, cfg->chunks) == -1)) {
+        fprintf(stderr, "Unable to start %d chunk writer threads\n", cfg->chunks);
+        return 1;
+    }
+
+    if (cfg->checkpoint_secs) {
+        st->ck = calloc(1, sizeof(*st->ck));
+        snprintf(st->ck->path, sizeof(st->ck->path), "%s.checkpoint", cfg->filename);
+        st->ck->period = cfg->checkpoint_secs;
+        st->ck->due = now_mono() + cfg->checkpoint_secs;
+        st->ck->started = now_real();
+        if (cfg->resume && ((resume_offset = checkpoint_load(st)) == -1))
+            return 1;
+        printf("Checkpoint: %s every %d s\n", st->ck->path, cfg->checkpoint_secs);
+    }
+
+    if (cfg->engine == ENGINE_PLUGIN) {
+        st->fd = -1;
+        if (engine_plugin_open(&st->plugin, cfg->engine_spec, cfg->filename,
+                cfg->durability == DURABILITY_OSYNC ? TW_ENGINE_OSYNC : 0) == -1)
+            return 1;
+        printf("Engine: %s (%s)\n", st->plugin.ops->name, st->plugin.dl ? cfg->engine_spec : "built-in");
+    } else if ((st->fd = open(cfg->filename,
+            O_WRONLY|O_CREAT|(cfg->resume ? 0 : O_TRUNC)|(cfg->durability == DURABILITY_OSYNC ? O_SYNC : 0),
+            (mode_t) 0666)) == -1) {
+        _errno = errno;
+        fprintf(stderr, "Unable to open %s : open() returned %d (%s)\n",
+            cfg->filename,
+            _errno,
+            strerror(_errno));
+        return 1;
+    }
+
+    if (cfg->lock_mode == LOCKMODE_HELD) {
+        if (flock(st->fd, LOCK_EX) == -1) {
+            _errno = errno;
+            fprintf(stderr, "Unable to place lock on %s : flock() returned %d (%s)\n",
+                cfg->filename,
+                _errno,
+                strerror(_errno));
+            return 1;
+        }
+    }
+
+    if ((cfg->durability == DURABILITY_DEFERRED) &&
+        (flusher_start(&st->flusher, st->fd, cfg->flush_ms, st->next_iter, cfg->iterations, cfg->quiet) == -1)) {
+        fprintf(stderr, "Unable to start flusher thread\n");
+        return 1;
+    }
+    if (cfg->durability == DURABILITY_WRITEBEHIND)
+        writebehind_init(&st->wb, st->fd, (off_t) cfg->window);
+    if (cfg->resume) {
+        // carry on after whatever reached FILENAME, checkpointed or not
+        end = lseek(st->fd, 0, SEEK_END);
+        if (end != resume_offset)
+            printf("%s is %lld bytes, %lld written after the checkpoint\n",
+                cfg->filename,
+                (long long) end,
+                (long long) (end - resume_offset));
+        st->offset = end;
+        if (cfg->durability == DURABILITY_WRITEBEHIND) {
+            st->wb.written = end;
+            st->wb.next = end / st->wb.window;
+        }
+    }
+    if (cfg->control_path) {
+        if ((st->wake_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1) {
+            fprintf(stderr, "eventfd() failed: %s\n", strerror(errno));
+            return 1;
+        }
+        if (control_start(st, cfg->control_path) == -1)
+            return 1;
+    }
+    if (cfg->trace_path) {
+        // a resumed run appends, so one trace covers the whole soak
+        if ((st->trace = fopen(cfg->trace_path, cfg->resume ? "a" : "w")) == NULL) {
+            fprintf(stderr, "Unable to open %s : %s\n", cfg->trace_path, strerror(errno));
+            return 1;
+        }
+        if (ftell(st->trace) == 0)
+            fprintf(st->trace, "time,seq,errno,bytes,latency\n");
+        printf("Trace: %s\n", cfg->trace_path);
+    }
+    throughput_init(&st->tp);
+    st->per_second = 1;
+    if (cfg->energy) {
+        st->rapl = malloc(sizeof(*st->rapl));
+        if (rapl_open(st->rapl) == -1) {
+            printf("Energy: unavailable, %s%s\n", strerror(errno),
+                errno == EACCES ? " (energy_uj is readable by root only)" : "");
+            free(st->rapl);
+            st->rapl = NULL;
+        } else {
+            printf("Energy: %d RAPL zones under %s\n", st->rapl->n, RAPL_ROOT);
+            energy_mark(st, &st->run_mark);
+            st->window_mark = st->run_mark;
+        }
+    }
+    if (cfg->dashboard && ((st->db = dashboard_start(st->live, cfg->filename)) == NULL)) {
+        fprintf(stderr, "Unable to start the dashboard\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+    release whatever a failed line_setup() got as far as, quietly and in
+    reverse; a library host keeps running after a failed create
+*/
+void line_setup_undo(struct line_state *st)
+{
+    const struct writer_config *cfg = st->cfg;
+
+    if (st->db)
+        dashboard_stop(st->db);
+    if (st->rapl)
+        rapl_close(st->rapl);
+    if (st->trace)
+        fclose(st->trace);
+    if (st->ctl)
+        control_stop(st);
+    if (st->wake_fd != -1)
+        close(st->wake_fd);
+    if (st->flusher.write_time)
+        flusher_cancel(&st->flusher);
+    if (st->plugin.ops) {
+        st->plugin.ops->close(st->plugin.ctx);
+        if (st->plugin.dl)
+            dlclose(st->plugin.dl);
+    }
+    if (st->fd != -1)
+        close(st->fd);
+    free(st->ck);
+    if (st->pool.nthreads)
+        chunk_pool_destroy(&st->pool);
+    if (cfg->payload == PAYLOAD_IOV)
+        iov_payload_free(&st->ip);
+    if (st->llc_fd != -1)
+        close(st->llc_fd);
+    if (st->fr) {
+        flight_recorder_close(st->fr);
+        free(st->fr);
+    }
+    if (st->live)
+        live_metrics_destroy(st->live, cfg->live_name);
+    free(st->write_buf);
+}
+
+
+/* stop helpers, print the run's summaries and release everything */
+void line_teardown(struct line_state *st)
+{
+    const struct writer_config *cfg = st->cfg;
+
+    if (st->db)
+        dashboard_stop(st->db);
+    printf("\n");
+    hist_print(line_write_label(st), &st->write_hist);
+    if (cfg->engine == ENGINE_CHUNKED) {
+        char label[32];
+
+        snprintf(label, sizeof(label), "%d chunks", cfg->chunks);
+        hist_print(label, &st->chunk_hist);
+        if (st->write_hist.count && st->chunk_hist.count)
+            printf("Logical block p50 chunked / single: %.3lf\n",
+                hist_percentile(&st->chunk_hist, 50) / hist_percentile(&st->write_hist, 50));
+        chunk_pool_destroy(&st->pool);
+    }
+    if (st->ctl) {
+        control_stop(st);
+        close(st->wake_fd);
+    }
+    if (st->lock_hist.count)
+        hist_print("lock wait", &st->lock_hist);
+    if (st->ck) {
+        char started[40];
+
+        if (checkpoint_write(st, st->next_iter) == 0)
+            printf("Checkpointed at sequence %d to %s\n", st->next_iter, st->ck->path);
+        if (st->ck->resumes) {
+            format_real(started, sizeof(started), st->ck->started);
+            printf("Soak started %s, resumed %d times; stats cover all runs\n", started, st->ck->resumes);
+        }
+        free(st->ck);
+    }
+    if (cfg->durability == DURABILITY_DEFERRED)
+        flusher_stop(&st->flusher);
+    else if (cfg->durability == DURABILITY_WRITEBEHIND)
+        writebehind_finish(&st->wb);
+    throughput_print(&st->tp);
+    if (st->rapl) {
+        char energy[HIST_LINE_MAX];
+
+        energy_format(st, &st->run_mark, energy, sizeof(energy));
+        printf("%-18s: %s\n", "energy", energy);
+        rapl_close(st->rapl);
+    }
+    if (st->fill_hist.count) {
+        hist_print("payload fill", &st->fill_hist);
+        if (st->llc_fd != -1) {
+            printf("LLC misses per iteration: fill %.1lf; write %.1lf\n",
+                (double) st->fill_misses / st->fill_hist.count,
+                (double) st->write_misses / st->fill_hist.count);
+            close(st->llc_fd);
+        }
+    }
+    if (cfg->payload == PAYLOAD_IOV)
+        iov_payload_free(&st->ip);
+    if (st->live)
+        live_metrics_destroy(st->live, cfg->live_name);
+    if (st->fr) {
+        flight_recorder_close(st->fr);
+        free(st->fr);
+    }
+    if (cfg->adapt_threshold_ms)
+        adaptive_report(&st->ad);
+    if (st->trace)
+        fclose(st->trace);
+
+    if (cfg->engine == ENGINE_PLUGIN)
+        engine_plugin_close(&st->plugin);
+    else
+        close(st->fd);
+    free(st->write_buf);
+}
+
+
+int line_writer(const struct writer_config *cfg)
+{
+    struct line_state st;
+    int rc;
+
+    printf("Filename: %s\n", cfg->filename);
+    printf("Exclusive lock: %s\n",
+        cfg->lock_mode == LOCKMODE_HELD ? "on" :
+        cfg->lock_mode == LOCKMODE_WRITE ? "around each write" : "off");
+    printf("Sleep after each write: %u\n", cfg->interval);
+    printf("Max iterations: %u\n", cfg->iterations);
+    printf("Max consecutive write fails: %u\n", cfg->failmax);
+    printf("Write size: %u\n", cfg->blocksize);
+    if (cfg->engine == ENGINE_CHUNKED)
+        printf("Parallel chunks: %d\n", cfg->chunks);
+    printf("Durability: %s\n",
+        cfg->durability == DURABILITY_OSYNC ? "O_SYNC" :
+        cfg->durability == DURABILITY_DEFERRED ? "deferred fsync()" :
+        cfg->durability == DURABILITY_WRITEBEHIND ? "write-behind" : "none");
+    if (cfg->durability == DURABILITY_DEFERRED)
+        printf("Flush interval: %d ms\n", cfg->flush_ms);
+    if (cfg->durability == DURABILITY_WRITEBEHIND)
+        printf("Write-behind window: %ld\n", cfg->window);
+
+    if (line_setup(&st, cfg)) {
+        line_setup_undo(&st);
+        return 1;
+    }
+    while ((rc = line_loop_select(&st)(&st)) == LINE_RESELECT)
+        ;
+    line_teardown(&st);
+    return rc;
+}
+
+
+/*
+    loopbench subcommand: per-iteration cost of the line loop with the
+    null engine, so no syscall hides it, for growing sets of modes; each
+    set runs through its specialised variant and through the generic loop
+*/
+static double loopbench_run(struct writer_config *cfg, int generic)
+{
+    struct line_state st;
+    double t;
+    int saved = dup(STDOUT_FILENO), null_fd = open("/dev/null", O_WRONLY);
+
+    // setup and teardown chatter is not what is being measured
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    if (line_setup(&st, cfg)) {
+        line_setup_undo(&st);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+        return -1;
+    }
+    t = now_mono();
+    if (generic)
+        line_loop_generic(&st);
+    else
+        line_loop_select(&st)(&st);
+    t = now_mono() - t;
+    line_teardown(&st);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return t / cfg->iterations * 1000000000;
+}
+
+
+int loopbench(int iterations)
+{
+    static const struct {
+        const char *label;
+        enum lock_mode lock_mode;
+        enum durability durability;
+        enum payload payload;
+    } sets[] = {
+        { "buf", LOCKMODE_NONE, DURABILITY_NONE, PAYLOAD_BUF },
+        { "buf+held lock", LOCKMODE_HELD, DURABILITY_NONE, PAYLOAD_BUF },
+        { "buf+held lock+writebehind", LOCKMODE_HELD, DURABILITY_WRITEBEHIND, PAYLOAD_BUF },
+        { "iov+held lock+writebehind", LOCKMODE_HELD, DURABILITY_WRITEBEHIND, PAYLOAD_IOV },
+        { "iov+held lock+deferred", LOCKMODE_HELD, DURABILITY_DEFERRED, PAYLOAD_IOV },
+    };
+    struct writer_config cfg;
+    char path[] = "/tmp/timed-writer.loopbench.XXXXXX";
+    int fd;
+
+    if ((fd = mkstemp(path)) == -1) {
+        fprintf(stderr, "Unable to create %s : %s\n", path, strerror(errno));
+        return 1;
+    }
+    close(fd);
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.filename = path;
+    cfg.iterations = iterations;
+    cfg.blocksize = 4096;
+    cfg.engine = ENGINE_NULL;
+    cfg.window = WINDOW_DEFAULT;
+    cfg.flush_ms = FLUSH_MS_DEFAULT;
+    cfg.quiet = 1;
+
+    printf("%-28s %16s %16s\n", "modes", "specialised ns", "generic ns");
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        cfg.lock_mode = sets[i].lock_mode;
+        cfg.durability = sets[i].durability;
+        cfg.payload = sets[i].payload;
+        printf("%-28s %16.1lf %16.1lf\n",
+            sets[i].label,
+            loopbench_run(&cfg, 0),
+            loopbench_run(&cfg, 1));
+    }
+    unlink(path);
+    return 0;
+}
+
+
+enum publish_step {
+    PUB_OPEN = 0,
+    PUB_WRITE,
+    PUB_FSYNC,
+    PUB_CLOSE,
+    PUB_LINK,
+    PUB_DIRSYNC,
+    PUB_TOTAL,
+    PUB_STEPS
+};
+
+static const char *publish_step_names[PUB_STEPS] = {
+    "open", "write", "fsync", "close", "publish", "dirsync", "total"
+};
+
+enum publish_pattern {
+    PUB_TMPFILE = 0,
+    PUB_RENAME,
+    PUB_PATTERNS
+};
+
+static const char *publish_pattern_names[PUB_PATTERNS] = {
+    "O_TMPFILE+linkat", "tmpfile+rename"
+};
+
+
+/*
+    linkat() with AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH, so fall back on
+    linking the /proc/self/fd magic symlink the way open(2) suggests
+*/
+static int link_tmpfile(int fd, const char *path)
+{
+    static int use_proc = 0;
+    char proc_path[64];
+
+    if (!use_proc) {
+        if (linkat(fd, "", AT_FDCWD, path, AT_EMPTY_PATH) == 0)
+            return 0;
+        if ((errno != EPERM) && (errno != ENOENT))
+            return -1;
+        use_proc = 1;
+    }
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+    return linkat(AT_FDCWD, proc_path, AT_FDCWD, path, AT_SYMLINK_FOLLOW);
+}
+
+
+/* one publish of write_buf as path, filling step timings; returns 0 or errno */
+static int publish_once(enum publish_pattern pattern,
+                        const char *dir,
+                        int dir_fd,
+                        const char *path,
+                        const void *write_buf,
+                        size_t write_actual,
+                        double *step)
+{
+    char tmp_path[PATH_MAX + 16];
+    double t0, t;
+    int fd;
+    ssize_t ws;
+
+    t0 = t = now_mono();
+    if (pattern == PUB_TMPFILE) {
+        fd = open(dir, O_TMPFILE|O_WRONLY, (mode_t) 0666);
+    } else {
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+        fd = open(tmp_path, O_WRONLY|O_CREAT|O_EXCL, (mode_t) 0666);
+    }
+    if (fd == -1)
+        return errno;
+    step[PUB_OPEN] = now_mono() - t;
+
+    t = now_mono();
+    ws = write(fd, write_buf, write_actual);
+    step[PUB_WRITE] = now_mono() - t;
+    if (ws != (ssize_t) write_actual) {
+        int _errno = ws == -1 ? errno : EIO;
+        close(fd);
+        if (pattern == PUB_RENAME)
+            unlink(tmp_path);
+        return _errno;
+    }
+
+    t = now_mono();
+    if (fsync(fd) == -1) {
+        int _errno = errno;
+        close(fd);
+        if (pattern == PUB_RENAME)
+            unlink(tmp_path);
+        return _errno;
+    }
+    step[PUB_FSYNC] = now_mono() - t;
+
+    if (pattern == PUB_TMPFILE) {
+        t = now_mono();
+        if (link_tmpfile(fd, path) == -1) {
+            int _errno = errno;
+            close(fd);
+            return _errno;
+        }
+        step[PUB_LINK] = now_mono() - t;
+        t = now_mono();
+        close(fd);
+        step[PUB_CLOSE] = now_mono() - t;
+    } else {
+        t = now_mono();
+        close(fd);
+        step[PUB_CLOSE] = now_mono() - t;
+        t = now_mono();
+        if (rename(tmp_path, path) == -1) {
+            int _errno = errno;
+            unlink(tmp_path);
+            return _errno;
+        }
+        step[PUB_LINK] = now_mono() - t;
+    }
+
+    t = now_mono();
+    if (fsync(dir_fd) == -1)
+        return errno;
+    step[PUB_DIRSYNC] = now_mono() - t;
+
+    step[PUB_TOTAL] = now_mono() - t0;
+    return 0;
+}
+
+
+int publish_writer(const struct writer_config *cfg)
+{
+    struct lat_hist hist[PUB_PATTERNS][PUB_STEPS];
+    char path[PUB_PATTERNS][PATH_MAX + 32];
+    char dir_buf[PATH_MAX];
+    char *dir;
+    void *write_buf;
+    size_t write_buf_size, write_actual;
+    double step[PUB_STEPS];
+    int dir_fd;
+    int _errno;
+    int failures = 0;
+
+    write_buf_size = cfg->blocksize > BS_DEF ? (size_t) cfg->blocksize : (size_t) BS_DEF;
+
+    printf("Filename prefix: %s\n", cfg->filename);
+    printf("Workload: publish (O_TMPFILE + linkat vs tmpfile + rename)\n");
+    printf("Sleep after each publish: %u\n", cfg->interval);
+    printf("Max iterations: %u\n", cfg->iterations);
+    printf("Max consecutive publish fails: %u\n", cfg->failmax);
+    printf("Write size: %u\n", cfg->blocksize);
+
+    snprintf(dir_buf, sizeof(dir_buf), "%s", cfg->filename);
+    dir = dirname(dir_buf);
+    if ((dir_fd = open(dir, O_RDONLY|O_DIRECTORY)) == -1) {
+        _errno = errno;
+        fprintf(stderr, "Unable to open directory %s : open() returned %d (%s)\n",
+            dir,
+            _errno,
+            strerror(_errno));
+        return 1;
+    }
+
+    write_buf = malloc(write_buf_size);
+    memset(write_buf, '\r', write_buf_size);
+    for (int p = 0; p < PUB_PATTERNS; p++)
+        for (int st = 0; st < PUB_STEPS; st++)
+            hist_init(&hist[p][st]);
+
+    for (int iter = 0; iter < cfg->iterations;) {
+        int failed = 0;
+
+        write_actual = payload_header(write_buf, iter, cfg->blocksize);
+        snprintf(path[PUB_TMPFILE], sizeof(path[PUB_TMPFILE]), "%s.tmpfile.%d", cfg->filename, iter);
+        snprintf(path[PUB_RENAME], sizeof(path[PUB_RENAME]), "%s.rename.%d", cfg->filename, iter);
+        printf("\nPublishing sequence %d (%zu bytes)\n", iter, write_actual);
+        // alternate which pattern goes first so neither always sees a warm cache
+        for (int n = 0; n < PUB_PATTERNS; n++) {
+            enum publish_pattern p = (enum publish_pattern) ((n + iter) % PUB_PATTERNS);
+
+            _errno = publish_once(p, dir, dir_fd, path[p], write_buf, write_actual, step);
+            if (_errno) {
+                fprintf(stderr, "%s publish of %s failed with errno %d (%s)\n",
+                    publish_pattern_names[p],
+                    path[p],
+                    _errno,
+                    strerror(_errno));
+                if (_errno == EOPNOTSUPP || _errno == EISDIR) {
+                    fprintf(stderr, "O_TMPFILE is not supported on %s ... bye!\n", dir);
+                    exit(EXIT_FAILURE);
+                }
+                failed = 1;
+                continue;
+            }
+            for (int st = 0; st < PUB_STEPS; st++)
+                hist_record(&hist[p][st], step[st]);
+            printf("%-16s took approx %.6lf seconds (open: %.6lf; write: %.6lf; fsync: %.6lf; "
+                "close: %.6lf; publish: %.6lf; dirsync: %.6lf)\n",
+                publish_pattern_names[p],
+                step[PUB_TOTAL],
+                step[PUB_OPEN],
+                step[PUB_WRITE],
+                step[PUB_FSYNC],
+                step[PUB_CLOSE],
+                step[PUB_LINK],
+                step[PUB_DIRSYNC]);
+        }
+        // published blobs are not kept, each iteration starts from the same directory state
+        for (int p = 0; p < PUB_PATTERNS; p++)
+            unlink(path[p]);
+        if (failed && (cfg->failmax > 0)) {
+            if (++failures == cfg->failmax) {
+                fprintf(stderr, "Reached max failcount ... bye!\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (!failed)
+            failures = 0;
+        if (++iter < cfg->iterations)
+            sleep(cfg->interval);
+    }
+
+    for (int p = 0; p < PUB_PATTERNS; p++) {
+        printf("\n%s:\n", publish_pattern_names[p]);
+        for (int st = 0; st < PUB_STEPS; st++)
+            hist_print(publish_step_names[st], &hist[p][st]);
+    }
+    if (hist[PUB_TMPFILE][PUB_TOTAL].count && hist[PUB_RENAME][PUB_TOTAL].count)
+        printf("\nEnd-to-end p50 O_TMPFILE+linkat / tmpfile+rename: %.3lf\n",
+            hist_percentile(&hist[PUB_TMPFILE][PUB_TOTAL], 50) /
+            hist_percentile(&hist[PUB_RENAME][PUB_TOTAL], 50));
+
+    close(dir_fd);
+    free(write_buf);
+
+    return 0;
+}
+
+
+#define APPEND_MAGIC        0x50415754      /* "TWAP" little-endian */
+
+/* framing of one O_APPEND record, payload follows up to len bytes in total */
+struct append_record {
+    uint32_t magic;
+    uint32_t writer;
+    uint64_t seq;
+    uint32_t len;
+    uint32_t crc;                           /* crc32c of the record with crc == 0 */
+};
+
+struct append_verdict {
+    unsigned long ok;
+    unsigned long torn;
+    unsigned long interleaved;
+    unsigned long garbage_bytes;
+    unsigned long duplicate;
+    unsigned long reordered;
+    unsigned long lost;
+};
+
+
+static size_t append_record_size(int blocksize)
+{
+    if ((size_t) blocksize > sizeof(struct append_record))
+        return (size_t) blocksize;
+    return sizeof(struct append_record) + 16;
+}
+
+
+static void append_record_fill(void *buf, size_t len, int writer, int seq)
+{
+    struct append_record rec;
+
+    memset((char *) buf + sizeof(rec), 'a' + writer % 26, len - sizeof(rec) - 1);
+    ((char *) buf)[len - 1] = '\n';
+    rec.magic = APPEND_MAGIC;
+    rec.writer = (uint32_t) writer;
+    rec.seq = (uint64_t) seq;
+    rec.len = (uint32_t) len;
+    rec.crc = 0;
+    memcpy(buf, &rec, sizeof(rec));
+    rec.crc = crc32c(0, buf, len);
+    memcpy(buf, &rec, sizeof(rec));
+}
+
+
+static void append_child(const struct writer_config *cfg,
+                         int writer,
+                         int start_fd,
+                         struct lat_hist *hist)
+{
+    size_t rec_len = append_record_size(cfg->blocksize);
+    void *rec_buf;
+    char c;
+    double t;
+    ssize_t ws;
+    int fd;
+    int failures = 0;
+
+    rec_buf = malloc(rec_len);
+    if ((fd = open(cfg->filename, O_WRONLY|O_APPEND, (mode_t) 0666)) == -1) {
+        fprintf(stderr, "Writer %d unable to open %s : %s\n", writer, cfg->filename, strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    // released all together when the parent closes its end of the pipe
+    while (read(start_fd, &c, 1) > 0)
+        ;
+    close(start_fd);
+
+    for (int seq = 0; seq < cfg->iterations;) {
+        append_record_fill(rec_buf, rec_len, writer, seq);
+        t = now_mono();
+        if (cfg->excl_lock)
+            flock(fd, LOCK_EX);
+        ws = write(fd, rec_buf, rec_len);
+        if (cfg->excl_lock)
+            flock(fd, LOCK_UN);
+        t = now_mono() - t;
+        if (ws == -1) {
+            fprintf(stderr, "Writer %d write() failed with errno %d (%s)\n", writer, errno, strerror(errno));
+            if ((cfg->failmax > 0) && (++failures == cfg->failmax)) {
+                fprintf(stderr, "Writer %d reached max failcount ... bye!\n", writer);
+                _exit(EXIT_FAILURE);
+            }
+        } else {
+            failures = 0;
+            hist_record(hist, t);
+        }
+        if (++seq < cfg->iterations)
+            sleep(cfg->interval);
+    }
+
+    close(fd);
+    free(rec_buf);
+    _exit(EXIT_SUCCESS);
+}
+
+
+/* stream through filename resynchronising on APPEND_MAGIC after any damage */
+static int append_verify(const char *filename,
+                         int writers,
+                         int iterations,
+                         size_t rec_len,
+                         struct append_verdict *v)
+{
+    size_t buf_size = rec_len * 2 > 1024 * 1024 ? rec_len * 2 : 1024 * 1024;
+    unsigned char *buf, *seen;
+    long long *last_seq;
+    size_t start = 0, avail = 0;
+    int eof = 0, in_garbage = 0;
+    ssize_t rs;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) == -1)
+        return -1;
+    buf = malloc(buf_size);
+    seen = calloc((size_t) writers * iterations, 1);
+    last_seq = malloc(sizeof(*last_seq) * writers);
+    for (int w = 0; w < writers; w++)
+        last_seq[w] = -1;
+    memset(v, 0, sizeof(*v));
+
+    for (;;) {
+        struct append_record rec;
+        uint32_t crc;
+
+        if ((avail < rec_len) && !eof) {
+            memmove(buf, buf + start, avail);
+            start = 0;
+            while ((avail < buf_size) && !eof) {
+                rs = read(fd, buf + avail, buf_size - avail);
+                if (rs <= 0)
+                    eof = 1;
+                else
+                    avail += (size_t) rs;
+            }
+        }
+        if (avail < sizeof(rec)) {
+            if (avail)
+                v->torn++;
+            break;
+        }
+        memcpy(&rec, buf + start, sizeof(rec));
+        if (rec.magic != APPEND_MAGIC) {
+            if (!in_garbage)
+                v->interleaved++;
+            in_garbage = 1;
+            v->garbage_bytes++;
+            start++;
+            avail--;
+            continue;
+        }
+        in_garbage = 0;
+        if ((rec.len < sizeof(rec)) || (rec.len > rec_len) || (rec.len > avail)) {
+            v->torn++;
+            start++;
+            avail--;
+            in_garbage = 1;
+            continue;
+        }
+        crc = rec.crc;
+        rec.crc = 0;
+        memcpy(buf + start, &rec, sizeof(rec));
+        rec.crc = crc32c(0, buf + start, rec.len);
+        memcpy(buf + start + offsetof(struct append_record, crc), &crc, sizeof(crc));
+        if ((rec.crc != crc) ||
+            (rec.writer >= (uint32_t) writers) ||
+            (rec.seq >= (uint64_t) iterations)) {
+            v->torn++;
+            start++;
+            avail--;
+            in_garbage = 1;
+            continue;
+        }
+        if (seen[rec.writer * iterations + rec.seq])
+            v->duplicate++;
+        else {
+            seen[rec.writer * iterations + rec.seq] = 1;
+            v->ok++;
+        }
+        if ((long long) rec.seq < last_seq[rec.writer])
+            v->reordered++;
+        last_seq[rec.writer] = (long long) rec.seq;
+        start += rec.len;
+        avail -= rec.len;
+    }
+    v->lost = (unsigned long) writers * iterations - v->ok;
+
+    close(fd);
+    free(last_seq);
+    free(seen);
+    free(buf);
+    return 0;
+}
+
+
+/* run writers processes appending concurrently, then verify the result */
+static int append_phase(const struct writer_config *cfg,
+                        int writers,
+                        struct lat_hist *merged,
+                        struct append_verdict *v)
+{
+    struct lat_hist *hist;
+    int start_pipe[2];
+    pid_t *pids;
+    int status, fd, rc = 0;
+
+    if ((fd = open(cfg->filename, O_WRONLY|O_CREAT|O_TRUNC, (mode_t) 0666)) == -1) {
+        fprintf(stderr, "Unable to open %s : %s\n", cfg->filename, strerror(errno));
+        return 1;
+    }
+    close(fd);
+
+    hist = mmap(NULL, sizeof(*hist) * writers, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (hist == MAP_FAILED) {
+        fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+        return 1;
+    }
+    pids = malloc(sizeof(*pids) * writers);
+    if (pipe(start_pipe) == -1) {
+        fprintf(stderr, "pipe() failed: %s\n", strerror(errno));
+        return 1;
+    }
+    fflush(stdout);
+    for (int w = 0; w < writers; w++) {
+        hist_init(&hist[w]);
+        if ((pids[w] = fork()) == 0) {
+            close(start_pipe[1]);
+            append_child(cfg, w, start_pipe[0], &hist[w]);
+        }
+    }
+    close(start_pipe[0]);
+    close(start_pipe[1]);
+
+    hist_init(merged);
+    for (int w = 0; w < writers; w++) {
+        if ((pids[w] == -1) || (waitpid(pids[w], &status, 0) == -1) ||
+            !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+            rc = 1;
+        hist_merge(merged, &hist[w]);
+    }
+
+    if (append_verify(cfg->filename, writers, cfg->iterations,
+            append_record_size(cfg->blocksize), v) == -1) {
+        fprintf(stderr, "Unable to verify %s : %s\n", cfg->filename, strerror(errno));
+        rc = 1;
+    }
+
+    munmap(hist, sizeof(*hist) * writers);
+    free(pids);
+    return rc;
+}
+
+
+int append_writer(const struct writer_config *cfg)
+{
+    struct lat_hist hist[WRITERS_MAX];
+    struct append_verdict verdict[WRITERS_MAX];
+    int counts[WRITERS_MAX];
+    int phases = 0;
+    int rc = 0;
+
+    printf("Filename: %s\n", cfg->filename);
+    printf("Workload: append (O_APPEND%s, up to %d writers)\n", cfg->excl_lock ? " under LOCK_EX" : "", cfg->writers);
+    printf("Sleep after each append: %u\n", cfg->interval);
+    printf("Appends per writer: %u\n", cfg->iterations);
+    printf("Record size: %zu\n", append_record_size(cfg->blocksize));
+
+    // sweep 1, 2, 4, ... writers so contention can be read off the table
+    for (int n = 1; ; n = n * 2 < cfg->writers ? n * 2 : cfg->writers) {
+        counts[phases] = n;
+        printf("\nAppending with %d writer%s\n", n, n == 1 ? "" : "s");
+        rc |= append_phase(cfg, n, &hist[phases], &verdict[phases]);
+        hist_print("append()", &hist[phases]);
+        phases++;
+        if (n == cfg->writers)
+            break;
+    }
+
+    printf("\n%7s %10s %10s %10s %10s %8s %8s %11s %8s %8s\n",
+        "writers", "p50 ms", "p99 ms", "max ms", "ok", "torn", "lost", "interleaved", "dup", "reorder");
+    for (int p = 0; p < phases; p++)
+        printf("%7d %10.3lf %10.3lf %10.3lf %10lu %8lu %8lu %11lu %8lu %8lu\n",
+            counts[p],
+            hist_percentile(&hist[p], 50) * 1000,
+            hist_percentile(&hist[p], 99) * 1000,
+            hist[p].max * 1000,
+            verdict[p].ok,
+            verdict[p].torn,
+            verdict[p].lost,
+            verdict[p].interleaved,
+            verdict[p].duplicate,
+            verdict[p].reordered);
+
+    return rc;
+}
+
+
+/*
+    -w cores: one thread pinned to each CPU we may run on, sharing
+    nothing while it runs.  Every thread owns its file FILENAME.CPU, its
+    buffers (allocated after pinning so they are local to its node), its
+    io_uring and a cache line aligned stats shard; shards are only read
+    after join.  io_uring is driven with raw syscalls to avoid a liburing
+    dependency, and a CPU that can't set up a ring falls back to pwrite().
+*/
+struct uring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+};
+
+struct core_shard {
+    const struct writer_config *cfg;
+    pthread_barrier_t *start;
+    int cpu;
+    int uring;                              /* io_uring, else pwrite() */
+    int setup_errno;
+    unsigned long writes;
+    unsigned long failures;
+    unsigned long long bytes;
+    double elapsed;                         /* writing, -s sleeps left out */
+    double slept;
+    struct lat_hist hist;
+} __attribute__((aligned(64)));
+
+
+static int uring_init(struct uring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    int saved;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    if ((r->fd = (int) syscall(__NR_io_uring_setup, entries, &p)) == -1)
+        return -1;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_size = r->cq_size = r->sq_size > r->cq_size ? r->sq_size : r->cq_size;
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else if ((r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+            r->fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+        goto fail;
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+    r->sq_head = (unsigned *) ((char *) r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *) ((char *) r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *) ((char *) r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *) ((char *) r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *) ((char *) r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *) ((char *) r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *) ((char *) r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) ((char *) r->cq_ptr + p.cq_off.cqes);
+    return 0;
+fail:
+    saved = errno;
+    if (r->sq_ptr && (r->sq_ptr != MAP_FAILED))
+        munmap(r->sq_ptr, r->sq_size);
+    if (r->cq_ptr && (r->cq_ptr != MAP_FAILED) && (r->cq_ptr != r->sq_ptr))
+        munmap(r->cq_ptr, r->cq_size);
+    close(r->fd);
+    errno = saved;
+    return -1;
+}
+
+
+static void uring_destroy(struct uring *r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    munmap(r->sq_ptr, r->sq_size);
+    close(r->fd);
+}
+
+
+/* queue a write, submitted by the next uring_enter() */
+static void uring_prep_write(struct uring *r, int fd, const void *buf, unsigned len, off_t offset, uint64_t data)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = len;
+    sqe->off = (uint64_t) offset;
+    sqe->user_data = data;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+static int uring_enter(struct uring *r, unsigned submit, unsigned wait)
+{
+    return (int) syscall(__NR_io_uring_enter, r->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+
+static void core_account(struct core_shard *cs, ssize_t res, double latency)
+{
+    if (res < 0)
+        cs->failures++;
+    else {
+        cs->writes++;
+        cs->bytes += (unsigned long long) res;
+        hist_record(&cs->hist, latency);
+    }
+}
+
+
+/* -s between writes or batches, kept out of the shard's elapsed time so IOPS stay IOPS */
+static void core_sleep(struct core_shard *cs)
+{
+    double t;
+
+    if (cs->cfg->interval == 0)
+        return;
+    t = now_mono();
+    sleep_for(cs->cfg->interval);
+    cs->slept += now_mono() - t;
+}
+
+
+/* account every completion posted so far and give its slot back, returns how many */
+static int core_reap(struct core_shard *cs, struct uring *r, const double *submitted,
+                     int *free_slots, int *nfree, int *streak)
+{
+    int n = 0;
+
+    for (unsigned head = *r->cq_head; head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE); head++, n++) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+
+        core_account(cs, cqe->res, now_mono() - submitted[cqe->user_data]);
+        *streak = cqe->res < 0 ? *streak + 1 : 0;
+        free_slots[(*nfree)++] = (int) cqe->user_data;
+        __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+
+/* up to depth writes in flight, each slot's buffer reused once its write completes */
+static void core_run_uring(struct core_shard *cs, struct uring *r, int fd, char *bufs, size_t buf_size, int depth)
+{
+    const struct writer_config *cfg = cs->cfg;
+    double *submitted = malloc(sizeof(double) * depth);
+    int *free_slots = malloc(sizeof(int) * depth);
+    int nfree = depth, next = 0, done = 0, unsubmitted = 0, streak = 0, failed = 0, rc;
+    off_t offset = 0;
+    double t;
+
+    for (int i = 0; i < depth; i++)
+        free_slots[i] = i;
+    while (done < cfg->iterations) {
+        t = now_mono();
+        for (; nfree && (next < cfg->iterations); unsubmitted++, next++) {
+            int slot = free_slots[--nfree];
+            size_t len = payload_header(bufs + slot * buf_size, next, cfg->blocksize);
+
+            uring_prep_write(r, fd, bufs + slot * buf_size, (unsigned) len, offset, (uint64_t) slot);
+            submitted[slot] = t;
+            offset += (off_t) len;
+        }
+        /*
+            the kernel may take fewer SQEs than offered, or none for now
+            (EAGAIN, EBUSY); it then returns without waiting and the rest
+            stay queued for the next enter
+        */
+        rc = uring_enter(r, (unsigned) unsubmitted, 1);
+        if (rc >= 0)
+            unsubmitted -= rc;
+        else if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+            fprintf(stderr, "CPU %d: io_uring_enter() failed: %s\n", cs->cpu, strerror(errno));
+            failed = 1;
+            break;
+        }
+        done += core_reap(cs, r, submitted, free_slots, &nfree, &streak);
+        if ((cfg->failmax > 0) && (streak >= cfg->failmax))
+            break;
+        if (done < cfg->iterations)
+            core_sleep(cs);
+    }
+    // the caller frees bufs, so wait out every write the kernel has taken; queued SQEs never go
+    while (nfree + unsubmitted < depth) {
+        if ((uring_enter(r, 0, 1) == -1) && (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+            break;
+        done += core_reap(cs, r, submitted, free_slots, &nfree, &streak);
+    }
+    if (failed)
+        cs->failures += (unsigned long) (cfg->iterations - done);
+    free(free_slots);
+    free(submitted);
+}
+
+
+static void core_run_pwrite(struct core_shard *cs, int fd, char *buf)
+{
+    const struct writer_config *cfg = cs->cfg;
+    off_t offset = 0;
+    int streak = 0;
+    ssize_t ws;
+    size_t len;
+    double t;
+
+    for (int iter = 0; iter < cfg->iterations; iter++) {
+        len = payload_header(buf, iter, cfg->blocksize);
+        t = now_mono();
+        ws = pwrite(fd, buf, len, offset);
+        core_account(cs, ws, now_mono() - t);
+        if (ws > 0)
+            offset += ws;
+        streak = ws == -1 ? streak + 1 : 0;
+        if ((cfg->failmax > 0) && (streak >= cfg->failmax))
+            break;
+        if (iter + 1 < cfg->iterations)
+            core_sleep(cs);
+    }
+}
+
+
+static void *core_main(void *arg)
+{
+    struct core_shard *cs = arg;
+    const struct writer_config *cfg = cs->cfg;
+    size_t buf_size = cfg->blocksize > BS_DEF ? (size_t) cfg->blocksize : (size_t) BS_DEF;
+    int depth = cfg->interval ? 1 : CORES_DEPTH;
+    char path[PATH_MAX], *bufs;
+    struct uring r;
+    cpu_set_t set;
+    int fd;
+
+    CPU_ZERO(&set);
+    CPU_SET(cs->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    hist_init(&cs->hist);
+    snprintf(path, sizeof(path), "%s.%d", cfg->filename, cs->cpu);
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|(cfg->durability == DURABILITY_OSYNC ? O_SYNC : 0), (mode_t) 0666);
+    if (fd == -1) {
+        cs->setup_errno = errno;
+        pthread_barrier_wait(cs->start);
+        return NULL;
+    }
+    // first touch after pinning, so pages come from this CPU's node
+    bufs = malloc(buf_size * depth);
+    memset(bufs, '\r', buf_size * depth);
+    if (uring_init(&r, (unsigned) depth) == 0)
+        cs->uring = 1;
+    else
+        cs->setup_errno = errno;
+
+    pthread_barrier_wait(cs->start);
+    cs->elapsed = now_mono();
+    if (cs->uring)
+        core_run_uring(cs, &r, fd, bufs, buf_size, depth);
+    else
+        core_run_pwrite(cs, fd, bufs);
+    cs->elapsed = now_mono() - cs->elapsed - cs->slept;
+
+    if (cs->uring)
+        uring_destroy(&r);
+    close(fd);
+    free(bufs);
+    return NULL;
+}
+
+
+int cores_writer(const struct writer_config *cfg)
+{
+    struct core_shard *shards;
+    pthread_barrier_t start;
+    pthread_t *threads;
+    struct lat_hist merged;
+    cpu_set_t allowed;
+    double iops, top = 0, bottom = 0, elapsed = 0;
+    unsigned long writes = 0, failures = 0;
+    unsigned long long bytes = 0;
+    int ncores = 0, rc = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        fprintf(stderr, "sched_getaffinity() failed: %s\n", strerror(errno));
+        return 1;
+    }
+    shards = aligned_alloc(64, sizeof(*shards) * CPU_COUNT(&allowed));
+    threads = malloc(sizeof(*threads) * CPU_COUNT(&allowed));
+    memset(shards, 0, sizeof(*shards) * CPU_COUNT(&allowed));
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &allowed)) {
+            shards[ncores].cfg = cfg;
+            shards[ncores].start = &start;
+            shards[ncores++].cpu = cpu;
+        }
+
+    printf("Filename: %s.CPU\n", cfg->filename);
+    printf("Workload: cores (%d pinned thread%s, io_uring depth %d)\n",
+        ncores,
+        ncores == 1 ? "" : "s",
+        cfg->interval ? 1 : CORES_DEPTH);
+    printf("Sleep after each %s: %u\n", cfg->interval ? "write" : "batch", cfg->interval);
+    printf("Writes per core: %u\n", cfg->iterations);
+    printf("Write size: %u\n", cfg->blocksize);
+    printf("Durability: %s\n", cfg->durability == DURABILITY_OSYNC ? "O_SYNC" : "none");
+
+    pthread_barrier_init(&start, NULL, (unsigned) ncores);
+    for (int i = 0; i < ncores; i++)
+        if (pthread_create(&threads[i], NULL, core_main, &shards[i]) != 0) {
+            fprintf(stderr, "Unable to start a thread for CPU %d\n", shards[i].cpu);
+            exit(EXIT_FAILURE);
+        }
+    for (int i = 0; i < ncores; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&start);
+
+    // shards are merged only here, after every thread is done
+    hist_init(&merged);
+    printf("\n%5s %-8s %10s %8s %10s %10s %10s %10s %10s\n",
+        "cpu", "engine", "writes", "fails", "IOPS", "MB/s", "p50 ms", "p99 ms", "max ms");
+    for (int i = 0; i < ncores; i++) {
+        struct core_shard *cs = &shards[i];
+
+        if (!cs->uring && !cs->elapsed) {
+            fprintf(stderr, "CPU %d: unable to open %s.%d : %s\n",
+                cs->cpu, cfg->filename, cs->cpu, strerror(cs->setup_errno));
+            rc = 1;
+            continue;
+        }
+        iops = cs->elapsed > 0 ? cs->writes / cs->elapsed : 0;
+        printf("%5d %-8s %10lu %8lu %10.1lf %10.2lf %10.3lf %10.3lf %10.3lf\n",
+            cs->cpu,
+            cs->uring ? "io_uring" : "pwrite",
+            cs->writes,
+            cs->failures,
+            iops,
+            cs->elapsed > 0 ? cs->bytes / cs->elapsed / 1000000 : 0,
+            hist_percentile(&cs->hist, 50) * 1000,
+            hist_percentile(&cs->hist, 99) * 1000,
+            cs->hist.max * 1000);
+        top = iops > top ? iops : top;
+        bottom = (bottom == 0) || (iops < bottom) ? iops : bottom;
+        elapsed = cs->elapsed > elapsed ? cs->elapsed : elapsed;
+        writes += cs->writes;
+        failures += cs->failures;
+        bytes += cs->bytes;
+        hist_merge(&merged, &cs->hist);
+        rc |= cs->failures ? 1 : 0;
+    }
+    printf("%5s %-8s %10lu %8lu %10.1lf %10.2lf %10.3lf %10.3lf %10.3lf\n",
+        "all",
+        "",
+        writes,
+        failures,
+        elapsed > 0 ? writes / elapsed : 0,
+        elapsed > 0 ? bytes / elapsed / 1000000 : 0,
+        hist_percentile(&merged, 50) * 1000,
+        hist_percentile(&merged, 99) * 1000,
+        merged.max * 1000);
+    for (int i = 0; i < ncores; i++)
+        if (!shards[i].uring && shards[i].elapsed)
+            printf("CPU %d used pwrite(): io_uring_setup() returned %d (%s)\n",
+                shards[i].cpu, shards[i].setup_errno, strerror(shards[i].setup_errno));
+    // a shared bottleneck shows as cores far apart, or as a total well short of cores * fastest
+    if (top > 0)
+        printf("Per-core IOPS spread: slowest %.0lf%% of fastest; total %.0lf%% of %d x fastest\n",
+            bottom / top * 100,
+            (elapsed > 0 ? writes / elapsed : 0) / (top * ncores) * 100,
+            ncores);
+
+    free(threads);
+    free(shards);
+    return rc;
+}
+
+
+/*
+    -w copyup: the first open() for writing of a file that only exists in
+    an overlayfs lower layer copies all of it up before returning.  Files
+    of growing sizes are staged in the topmost lower layer, pushed out of
+    the page cache as a freshly pulled image would be, then opened and
+    written through the merged directory by 1, 2, 4 ... WRITERS threads
+    at once.  Each file gets one copy-up, one first write and MAX_ITER
+    steady state writes.
+
+    Changing the lower layer of a mounted overlay is undefined, and an
+    existing mount's lower layer is typically an image layer shared by
+    every container of that image, so the overlay is always our own from
+    -O: it is mounted only while a phase runs, with staging and cleanup
+    done on the bare layers in between.
+*/
+struct overlay_dirs {
+    const char *merged;
+    char lower[PATH_MAX];                   /* topmost lower layer */
+    char upper[PATH_MAX];
+    char opts[PATH_MAX + 32];
+    int mounted;
+};
+
+struct copyup_file {
+    const struct writer_config *cfg;
+    pthread_barrier_t *start;
+    char merged[PATH_MAX];
+    char lower[PATH_MAX + NAME_MAX + 1];    /* layer paths are PATH_MAX on their own */
+    char upper[PATH_MAX + NAME_MAX + 1];
+    size_t size;
+    double open_latency;                    /* includes the copy-up */
+    double first_latency;
+    struct lat_hist steady;
+    int copied;                             /* found in the upper layer afterwards */
+    int _errno;
+};
+
+
+/* undo the octal escapes of /proc/self/mountinfo in place */
+static void mountinfo_unescape(char *s)
+{
+    char *d = s;
+
+    while (*s) {
+        if ((s[0] == '\\') && (s[1] >= '0') && (s[1] <= '3') && s[2] && s[3]) {
+            *d++ = (char) (((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0'));
+            s += 4;
+        } else
+            *d++ = *s++;
+    }
+    *d = '\0';
+}
+
+
+/* split a /proc/self/mountinfo line in place, 0 if it has every field */
+static int mountinfo_parse(char *line, char **mnt, char **fstype, char **options)
+{
+    char *save, *sep;
+
+    // ID PARENT MAJ:MIN ROOT MOUNTPOINT OPTIONS [OPTIONAL...] - FSTYPE SOURCE SUPEROPTIONS
+    line[strcspn(line, "\n")] = '\0';
+    if ((sep = strstr(line, " - ")) == NULL)
+        return -1;
+    *sep = '\0';
+    strtok_r(line, " ", &save);
+    for (int i = 0; i < 3; i++)
+        strtok_r(NULL, " ", &save);
+    if ((*mnt = strtok_r(NULL, " ", &save)) == NULL)
+        return -1;
+    mountinfo_unescape(*mnt);
+    if (((*fstype = strtok_r(sep + 3, " ", &save)) == NULL) || (strtok_r(NULL, " ", &save) == NULL))
+        return -1;
+    *options = strtok_r(NULL, " ", &save);
+    return *options ? 0 : -1;
+}
+
+
+/* -O LOWER:UPPER:WORK, LOWER itself may be a colon separated stack; checked by a first mount */
+static int overlay_parse(const char *merged, const char *spec, struct overlay_dirs *od)
+{
+    char layers[PATH_MAX], *work, *upper;
+
+    if (strlen(spec) >= sizeof(layers)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    snprintf(layers, sizeof(layers), "%s", spec);
+    if (((work = strrchr(layers, ':')) == NULL) || (work == layers)) {
+        errno = EINVAL;
+        return -1;
+    }
+    *work++ = '\0';
+    if (((upper = strrchr(layers, ':')) == NULL) || (upper == layers)) {
+        errno = EINVAL;
+        return -1;
+    }
+    *upper++ = '\0';
+    snprintf(od->opts, sizeof(od->opts), "lowerdir=%s,upperdir=%s,workdir=%s", layers, upper, work);
+    od->merged = merged;
+    snprintf(od->lower, sizeof(od->lower), "%s", layers);
+    if ((work = strchr(od->lower, ':')) != NULL)
+        *work = '\0';
+    snprintf(od->upper, sizeof(od->upper), "%s", upper);
+    if ((mount("overlay", merged, "overlay", 0, od->opts) == -1) || (umount2(merged, 0) == -1))
+        return -1;
+    return 0;
+}
+
+
+static int overlay_attach(struct overlay_dirs *od)
+{
+    if (mount("overlay", od->merged, "overlay", 0, od->opts) == -1) {
+        fprintf(stderr, "Unable to mount overlay on %s : %s\n", od->merged, strerror(errno));
+        return -1;
+    }
+    od->mounted = 1;
+    return 0;
+}
+
+
+static int overlay_detach(struct overlay_dirs *od)
+{
+    if (umount2(od->merged, 0) == -1) {
+        fprintf(stderr, "Unable to unmount %s : %s\n", od->merged, strerror(errno));
+        return -1;
+    }
+    od->mounted = 0;
+    return 0;
+}
+
+
+/* write size bytes to path in the lower layer and drop them from the page cache */
+static int copyup_stage(const char *path, size_t size)
+{
+    size_t chunk = 1024 * 1024, done = 0, len;
+    char *buf = malloc(chunk);
+    int fd, rc = 0;
+
+    if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, (mode_t) 0644)) == -1) {
+        free(buf);
+        return -1;
+    }
+    for (int i = 0; (done < size) && (rc == 0); i++) {
+        len = size - done < chunk ? size - done : chunk;
+        payload_fill_scalar(buf, len, i);
+        if (write(fd, buf, len) != (ssize_t) len)
+            rc = -1;
+        done += len;
+    }
+    if ((rc == 0) && (fsync(fd) == 0))
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    free(buf);
+    return rc;
+}
+
+
+static void *copyup_main(void *arg)
+{
+    struct copyup_file *cf = arg;
+    const struct writer_config *cfg = cf->cfg;
+    size_t buf_size = cfg->blocksize > BS_DEF ? (size_t) cfg->blocksize : (size_t) BS_DEF;
+    char *buf = malloc(buf_size);
+    size_t len;
+    off_t offset = 0;
+    ssize_t ws;
+    double t;
+    int fd;
+
+    memset(buf, '\r', buf_size);
+    hist_init(&cf->steady);
+    pthread_barrier_wait(cf->start);
+    t = now_mono();
+    fd = open(cf->merged, O_WRONLY|(cfg->durability == DURABILITY_OSYNC ? O_SYNC : 0));
+    cf->open_latency = now_mono() - t;
+    if (fd == -1) {
+        cf->_errno = errno;
+        free(buf);
+        return NULL;
+    }
+    for (int iter = 0; iter <= cfg->iterations; iter++) {
+        len = payload_header(buf, iter, cfg->blocksize);
+        // stay inside the file, steady writes overwrite copied up blocks
+        if (offset + (off_t) len > (off_t) cf->size)
+            offset = 0;
+        t = now_mono();
+        ws = pwrite(fd, buf, len, offset);
+        t = now_mono() - t;
+        if (ws == -1) {
+            cf->_errno = errno;
+            break;
+        }
+        offset += ws;
+        if (iter == 0)
+            cf->first_latency = t;
+        else
+            hist_record(&cf->steady, t);
+    }
+    close(fd);
+    cf->copied = access(cf->upper, F_OK) == 0;
+    free(buf);
+    return NULL;
+}
+
+
+/* copy up writers files of size bytes at once, one table row */
+static int copyup_phase(const struct writer_config *cfg, struct overlay_dirs *od, size_t size, int writers)
+{
+    struct copyup_file *files = calloc((size_t) writers, sizeof(*files));
+    pthread_t *threads = malloc(sizeof(*threads) * writers);
+    struct lat_hist open_hist, first_hist, steady;
+    pthread_barrier_t start;
+    double slowest = 0;
+    int copied = 0, rc = 0;
+
+    for (int w = 0; w < writers; w++) {
+        struct copyup_file *cf = &files[w];
+        char name[NAME_MAX];
+
+        snprintf(name, sizeof(name), ".timed-writer.copyup.%d.%zu.%d", (int) getpid(), size, w);
+        snprintf(cf->merged, sizeof(cf->merged), "%s/%s", cfg->filename, name);
+        snprintf(cf->lower, sizeof(cf->lower), "%s/%s", od->lower, name);
+        snprintf(cf->upper, sizeof(cf->upper), "%s/%s", od->upper, name);
+        cf->cfg = cfg;
+        cf->start = &start;
+        cf->size = size;
+        if (copyup_stage(cf->lower, size) == -1) {
+            fprintf(stderr, "Unable to stage %s : %s\n", cf->lower, strerror(errno));
+            writers = w;
+            rc = 1;
+            break;
+        }
+    }
+    // the overlay only sees the staged files once they are all in place
+    if (writers && (overlay_attach(od) == -1)) {
+        for (int w = 0; w < writers; w++)
+            unlink(files[w].lower);
+        free(threads);
+        free(files);
+        return 1;
+    }
+    if (writers) {
+        pthread_barrier_init(&start, NULL, (unsigned) writers);
+        for (int w = 0; w < writers; w++)
+            if (pthread_create(&threads[w], NULL, copyup_main, &files[w]) != 0) {
+                fprintf(stderr, "Unable to start copy-up thread\n");
+                exit(EXIT_FAILURE);
+            }
+        for (int w = 0; w < writers; w++)
+            pthread_join(threads[w], NULL);
+        pthread_barrier_destroy(&start);
+        if (overlay_detach(od) == -1)
+            exit(EXIT_FAILURE);
+    }
+
+    hist_init(&open_hist);
+    hist_init(&first_hist);
+    hist_init(&steady);
+    for (int w = 0; w < writers; w++) {
+        struct copyup_file *cf = &files[w];
+
+        if (cf->_errno) {
+            fprintf(stderr, "%s : %s\n", cf->merged, strerror(cf->_errno));
+            rc = 1;
+        }
+        hist_record(&open_hist, cf->open_latency);
+        hist_record(&first_hist, cf->first_latency);
+        hist_merge(&steady, &cf->steady);
+        slowest = cf->open_latency > slowest ? cf->open_latency : slowest;
+        copied += cf->copied;
+        // unmounted, so no whiteouts are left behind
+        unlink(cf->lower);
+        unlink(cf->upper);
+    }
+    if (writers)
+        printf("%10zu %7d %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10.1lf %4d/%d\n",
+            size,
+            writers,
+            hist_percentile(&open_hist, 50) * 1000,
+            open_hist.max * 1000,
+            hist_percentile(&first_hist, 50) * 1000,
+            hist_percentile(&steady, 50) * 1000,
+            hist_percentile(&steady, 99) * 1000,
+            slowest > 0 ? (double) size * writers / slowest / 1000000 : 0,
+            copied,
+            writers);
+    fflush(stdout);
+    free(threads);
+    free(files);
+    return rc;
+}
+
+
+int copyup_writer(const struct writer_config *cfg)
+{
+    struct overlay_dirs od;
+    int rc = 0;
+
+    memset(&od, 0, sizeof(od));
+    if (overlay_parse(cfg->filename, cfg->overlay_spec, &od) == -1) {
+        fprintf(stderr, "Unable to mount overlay %s on %s : %s\n",
+            cfg->overlay_spec,
+            cfg->filename,
+            strerror(errno));
+        return 1;
+    }
+
+    printf("Merged: %s (mounted for each phase)\n", cfg->filename);
+    printf("Lower layer: %s\n", od.lower);
+    printf("Upper layer: %s\n", od.upper);
+    printf("Workload: copyup (%d to %d KiB files, up to %d at once)\n",
+        COPYUP_SIZE_MIN / 1024,
+        COPYUP_SIZE_MAX / 1024,
+        cfg->writers);
+    printf("Steady writes per file: %u\n", cfg->iterations);
+    printf("Write size: %u\n", cfg->blocksize);
+    printf("Durability: %s\n", cfg->durability == DURABILITY_OSYNC ? "O_SYNC" : "none");
+
+    printf("\n%10s %7s %10s %10s %10s %10s %10s %10s %6s\n",
+        "size", "files", "open ms", "open max", "1st wr ms", "steady p50", "steady p99", "copy MB/s", "copied");
+    for (size_t size = COPYUP_SIZE_MIN; size <= COPYUP_SIZE_MAX; size *= 4)
+        for (int n = 1; ; n = n * 2 < cfg->writers ? n * 2 : cfg->writers) {
+            rc |= copyup_phase(cfg, &od, size, n);
+            if (n == cfg->writers)
+                break;
+        }
+    printf("open ms is the copy-up; copy MB/s is bytes copied up over the slowest open\n");
+    return rc;
+}
+
+
+/*
+    -w automount: FILENAME lives under an automount point and every
+    iteration is a fresh access to it, with stat(), open() and the first
+    write() timed apart so the mount trigger shows up in stat().  Before
+    each access the mount FILENAME ended up on is expired with
+    umount2(MNT_EXPIRE) when autofs manages it and we're allowed to,
+    otherwise SLEEP has to outlast the autofs timeout.  An access is
+    cold when it brought a mount in, seen as a new mount covering
+    FILENAME or a new st_dev.
+*/
+struct automount_state {
+    char mountpoint[PATH_MAX];              /* covering FILENAME after the last access */
+    char fstype[64];
+    dev_t dev;
+    int force;                              /* expire with umount2() before each access */
+    unsigned long cold;
+    unsigned long warm;
+    unsigned long busy;                     /* expiry refused, still in use */
+};
+
+
+/* the mount at path, or covering it when prefix; of type want if set; 1 if found */
+static int mountinfo_find(const char *path, int prefix, const char *want, char *mp, size_t mp_size,
+                          char *type, size_t type_size)
+{
+    char line[PATH_MAX * 4], *mnt, *fstype, *opts;
+    size_t best = 0, len;
+    int found = 0;
+    FILE *f;
+
+    if ((f = fopen("/proc/self/mountinfo", "r")) == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f)) {
+        if ((mountinfo_parse(line, &mnt, &fstype, &opts) == -1) || (want && (strcmp(fstype, want) != 0)))
+            continue;
+        len = strlen(mnt);
+        if (prefix) {
+            // "/" covers everything, "/a" covers "/a/b" but not "/ab"
+            if ((strncmp(mnt, path, len) != 0) ||
+                ((len > 1) && (path[len] != '\0') && (path[len] != '/')) || (len < best))
+                continue;
+        } else if (strcmp(mnt, path) != 0)
+            continue;
+        // mounts stacked on one point are listed bottom up, the last one is what a lookup sees
+        best = len;
+        found = 1;
+        if (mp)
+            snprintf(mp, mp_size, "%s", mnt);
+        if (type)
+            snprintf(type, type_size, "%s", fstype);
+    }
+    fclose(f);
+    return found;
+}
+
+
+/* an autofs mount sits on the mount point (direct map) or on its parent (indirect map) */
+static int automount_managed(const char *mountpoint)
+{
+    char parent[PATH_MAX], *slash;
+
+    if (mountinfo_find(mountpoint, 0, "autofs", NULL, 0, NULL, 0))
+        return 1;
+    snprintf(parent, sizeof(parent), "%s", mountpoint);
+    if ((slash = strrchr(parent, '/')) == NULL)
+        return 0;
+    *(slash == parent ? slash + 1 : slash) = '\0';
+    return mountinfo_find(parent, 0, "autofs", NULL, 0, NULL, 0);
+}
+
+
+/* the first MNT_EXPIRE only marks the mount, the second unmounts it if nothing used it since */
+static int automount_expire(const char *mountpoint)
+{
+    if ((umount2(mountpoint, MNT_EXPIRE) == -1) && (errno != EAGAIN))
+        return -1;
+    return umount2(mountpoint, MNT_EXPIRE);
+}
+
+
+int automount_writer(const struct writer_config *cfg)
+{
+    const char *phase[3] = { "stat()", "open()", "write()" };
+    struct automount_state as;
+    struct lat_hist hist[2][3];             /* cold, warm */
+    size_t buf_size = cfg->blocksize > BS_DEF ? (size_t) cfg->blocksize : (size_t) BS_DEF;
+    char *buf = malloc(buf_size), before[PATH_MAX], before_type[64], label[32];
+    double t, latency[3];
+    struct stat sb;
+    int failures = 0, fd, cold;
+    size_t len;
+    ssize_t ws;
+
+    memset(&as, 0, sizeof(as));
+    memset(buf, '\r', buf_size);
+    for (int c = 0; c < 2; c++)
+        for (int p = 0; p < 3; p++)
+            hist_init(&hist[c][p]);
+
+    printf("Filename: %s\n", cfg->filename);
+    printf("Workload: automount (stat(), open() and write() of a fresh access per iteration)\n");
+    printf("Sleep after each access: %u\n", cfg->interval);
+    printf("Max iterations: %u\n", cfg->iterations);
+    printf("Max consecutive write fails: %u\n", cfg->failmax);
+    printf("Write size: %u\n", cfg->blocksize);
+    printf("Durability: %s\n", cfg->durability == DURABILITY_OSYNC ? "O_SYNC" : "none");
+
+    for (int iter = 0; iter < cfg->iterations; iter++) {
+        if (iter) {
+            sleep_for(cfg->interval);
+            if (as.force && (automount_expire(as.mountpoint) == -1)) {
+                if (errno == EBUSY)
+                    as.busy++;
+                else if (errno != EINVAL) {
+                    printf("umount2(%s, MNT_EXPIRE) returned %d (%s), waiting for autofs instead\n",
+                        as.mountpoint,
+                        errno,
+                        strerror(errno));
+                    as.force = 0;
+                }
+            }
+        }
+        // reading mountinfo doesn't trigger the automount, stat() does
+        before[0] = before_type[0] = '\0';
+        mountinfo_find(cfg->filename, 1, NULL, before, sizeof(before), before_type, sizeof(before_type));
+
+        t = now_mono();
+        if ((stat(cfg->filename, &sb) == -1) && (errno != ENOENT))
+            fprintf(stderr, "stat() failed with errno %d (%s)\n", errno, strerror(errno));
+        latency[0] = now_mono() - t;
+        t = now_mono();
+        fd = open(cfg->filename, O_WRONLY|O_CREAT|O_TRUNC|(cfg->durability == DURABILITY_OSYNC ? O_SYNC : 0),
+            (mode_t) 0666);
+        latency[1] = now_mono() - t;
+        ws = -1;
+        if (fd == -1)
+            fprintf(stderr, "open() failed with errno %d (%s)\n", errno, strerror(errno));
+        else {
+            len = payload_header(buf, iter, cfg->blocksize);
+            t = now_mono();
+            ws = write(fd, buf, len);
+            latency[2] = now_mono() - t;
+            if (ws == -1)
+                fprintf(stderr, "write() failed with errno %d (%s)\n", errno, strerror(errno));
+            fstat(fd, &sb);
+            close(fd);
+        }
+
+        mountinfo_find(cfg->filename, 1, NULL, as.mountpoint, sizeof(as.mountpoint), as.fstype, sizeof(as.fstype));
+        cold = (strcmp(before, as.mountpoint) != 0) || (strcmp(before_type, as.fstype) != 0) ||
+            ((fd != -1) && iter && (sb.st_dev != as.dev));
+        if (fd != -1)
+            as.dev = sb.st_dev;
+        if (iter == 0) {
+            as.force = (strcmp(as.fstype, "autofs") != 0) && (strcmp(as.mountpoint, "/") != 0) &&
+                automount_managed(as.mountpoint);
+            printf("Mount: %s (%s)%s\n", as.mountpoint, as.fstype, automount_managed(as.mountpoint) ?
+                ", managed by autofs" : ", not under autofs");
+            printf("Expiry: %s\n", as.force ? "umount2(MNT_EXPIRE) before each access" :
+                "none forced, relying on SLEEP outlasting the autofs timeout");
+        }
+        if (cold)
+            as.cold++;
+        else
+            as.warm++;
+        for (int p = 0; p < (ws == -1 ? 2 : 3); p++)
+            hist_record(&hist[cold ? 0 : 1][p], latency[p]);
+        if (!cfg->quiet) {
+            printf("Sequence %d %s: stat() %.3lf ms, open() %.3lf ms", iter, cold ? "cold" : "warm",
+                latency[0] * 1000, latency[1] * 1000);
+            if (ws != -1)
+                printf(", write() %.3lf ms", latency[2] * 1000);
+            printf("\n");
+            fflush(stdout);
+        }
+
+        if (ws == -1) {
+            if ((cfg->failmax > 0) && (++failures == cfg->failmax)) {
+                fprintf(stderr, "Reached max failcount ... bye!\n");
+                exit(EXIT_FAILURE);
+            }
+        } else
+            failures = 0;
+    }
+
+    printf("\nAccesses: %lu cold, %lu warm", as.cold, as.warm);
+    if (as.busy)
+        printf(", %lu expiries refused as busy", as.busy);
+    printf("\n");
+    for (int c = 0; c < 2; c++)
+        for (int p = 0; p < 3; p++) {
+            snprintf(label, sizeof(label), "%s %s", c ? "warm" : "cold", phase[p]);
+            hist_print(label, &hist[c][p]);
+        }
+    free(buf);
+    return 0;
+}
+
+
+/*
+    hierarchical timing wheel: WHEEL_LEVELS wheels of WHEEL_SLOTS slots,
+    level l slots are WHEEL_SLOTS^l ticks wide.  Insert and cancel are O(1)
+    list operations, a slot of a higher level is cascaded down when the
+    level below wraps, and a single timerfd is armed for the next occupied
+    slot or cascade, whichever comes first.
+*/
+struct wheel_timer {
+    struct wheel_timer *next;
+    struct wheel_timer *prev;
+    uint64_t expires;                       /* absolute tick */
+    int level;
+    int slot;
+};
+
+typedef void (*wheel_callback)(struct wheel_timer *timer, void *arg);
+
+struct timing_wheel {
+    uint64_t now;                           /* ticks before now have been expired */
+    double origin;                          /* CLOCK_MONOTONIC of tick 0 */
+    struct wheel_timer slot[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_LEVELS][WHEEL_SLOTS / 64];
+    unsigned long pending;
+    int timerfd;
+};
+
+
+int wheel_init(struct timing_wheel *w)
+{
+    memset(w, 0, sizeof(*w));
+    for (int l = 0; l < WHEEL_LEVELS; l++)
+        for (int s = 0; s < WHEEL_SLOTS; s++)
+            w->slot[l][s].next = w->slot[l][s].prev = &w->slot[l][s];
+    w->origin = now_mono();
+    if ((w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) == -1)
+        return -1;
+    return 0;
+}
+
+
+uint64_t wheel_tick(const struct timing_wheel *w, double when)
+{
+    double ticks = (when - w->origin) * 1000000000 / WHEEL_TICK_NS;
+
+    return ticks > 0 ? (uint64_t) ceil(ticks) : 0;
+}
+
+
+double wheel_time(const struct timing_wheel *w, uint64_t tick)
+{
+    return w->origin + (double) tick * WHEEL_TICK_NS / 1000000000;
+}
+
+
+void wheel_add(struct timing_wheel *w, struct wheel_timer *t, uint64_t expires)
+{
+    uint64_t delta;
+    struct wheel_timer *head;
+    int level = 0;
+
+    if (expires < w->now)
+        expires = w->now;
+    delta = expires - w->now;
+    while ((level < WHEEL_LEVELS - 1) && (delta >= (1ULL << (WHEEL_BITS * (level + 1)))))
+        level++;
+    if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)))
+        expires = w->now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    t->expires = expires;
+    t->level = level;
+    t->slot = (int) ((expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+    head = &w->slot[level][t->slot];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    w->occupied[level][t->slot / 64] |= 1ULL << (t->slot % 64);
+    w->pending++;
+}
+
+
+void wheel_del(struct timing_wheel *w, struct wheel_timer *t)
+{
+    struct wheel_timer *head = &w->slot[t->level][t->slot];
+
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    if (head->next == head)
+        w->occupied[t->level][t->slot / 64] &= ~(1ULL << (t->slot % 64));
+    w->pending--;
+}
+
+
+/* detach every timer of a slot, returning them as a NULL terminated list */
+static struct wheel_timer *wheel_take(struct timing_wheel *w, int level, int slot)
+{
+    struct wheel_timer *head = &w->slot[level][slot];
+    struct wheel_timer *first = head->next;
+
+    if (first == head)
+        return NULL;
+    head->prev->next = NULL;
+    head->next = head->prev = head;
+    w->occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+    return first;
+}
+
+
+/* expire every timer up to and including tick, returns the number fired */
+unsigned long wheel_advance(struct timing_wheel *w, uint64_t tick, wheel_callback cb, void *arg)
+{
+    struct wheel_timer *t, *next;
+    unsigned long fired = 0;
+
+    for (; w->now <= tick; w->now++) {
+        int idx = (int) (w->now & (WHEEL_SLOTS - 1));
+
+        // level 0 wrapped: pull the next slot of each level above down
+        for (int l = 1; (idx == 0) && (w->now > 0) && (l < WHEEL_LEVELS); l++) {
+            int s = (int) ((w->now >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1));
+
+            for (t = wheel_take(w, l, s); t; t = next) {
+                next = t->next;
+                w->pending--;
+                wheel_add(w, t, t->expires);
+            }
+            if (s != 0)
+                break;
+        }
+        for (t = wheel_take(w, 0, idx); t; t = next) {
+            next = t->next;
+            t->next = t->prev = NULL;
+            w->pending--;
+            fired++;
+            cb(t, arg);
+        }
+    }
+    return fired;
+}
+
+
+/* arm the timerfd for the next occupied level 0 slot or the next cascade */
+void wheel_arm(struct timing_wheel *w)
+{
+    struct itimerspec its;
+    uint64_t next = (w->now | (WHEEL_SLOTS - 1)) + 1;
+    double when;
+
+    memset(&its, 0, sizeof(its));
+    if (w->pending) {
+        for (uint64_t tick = w->now; tick < next; tick++) {
+            int s = (int) (tick & (WHEEL_SLOTS - 1));
+
+            if (!w->occupied[0][s / 64]) {
+                tick |= 63;
+                continue;
+            }
+            if (w->occupied[0][s / 64] & (1ULL << (s % 64))) {
+                next = tick;
+                break;
+            }
+        }
+        when = wheel_time(w, next);
+        its.it_value.tv_sec = (time_t) when;
+        its.it_value.tv_nsec = (long) ((when - (double) its.it_value.tv_sec) * 1000000000);
+        if ((its.it_value.tv_sec == 0) && (its.it_value.tv_nsec == 0))
+            its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(w->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+
+void wheel_destroy(struct timing_wheel *w)
+{
+    close(w->timerfd);
+}
+
+
+/* fixed size FIFO of pointers, callers provide the locking */
+struct ptr_ring {
+    void **slot;
+    int size;
+    int head;
+    int len;
+};
+
+
+int ptr_ring_init(struct ptr_ring *r, int size)
+{
+    r->slot = calloc((size_t) size, sizeof(*r->slot));
+    r->size = size;
+    r->head = 0;
+    r->len = 0;
+    return r->slot ? 0 : -1;
+}
+
+
+void ptr_ring_push(struct ptr_ring *r, void *p)
+{
+    r->slot[(r->head + r->len) % r->size] = p;
+    r->len++;
+}
+
+
+void *ptr_ring_pop(struct ptr_ring *r)
+{
+    void *p = r->slot[r->head];
+
+    r->head = (r->head + 1) % r->size;
+    r->len--;
+    return p;
+}
+
+
+void ptr_ring_free(struct ptr_ring *r)
+{
+    free(r->slot);
+}
+
+
+/*
+    daemon subcommand: one process probes every target listed in CONFIG.
+    The main thread owns the timing wheel and hands due probes to a small
+    pool of worker threads, so a mount that hangs in write() ties up a
+    worker but neither the schedule nor the other targets.  Workers pass
+    finished targets back through the done ring for rescheduling.
+*/
+struct probe_target {
+    char path[PATH_MAX];
+    int interval;
+    int blocksize;
+    int excl_lock;
+    enum durability durability;
+    int fd;
+    int truncated;
+    void *buf;
+    size_t buf_size;
+    int in_flight;
+    double next_due;                        /* CLOCK_MONOTONIC */
+    unsigned long seq;
+    unsigned long writes;
+    unsigned long failures;
+    unsigned long streak;
+    unsigned long missed;                   /* due while the previous probe was still running */
+    int backoff;
+    int last_errno;
+    double last_latency;
+    struct lat_hist hist;
+    struct wheel_timer timer;
+};
+
+struct probe_daemon {
+    struct probe_target *targets;
+    int ntargets;
+    int max_iter;
+    const char *metrics_file;
+    int export_interval;
+    pthread_mutex_t lock;
+    pthread_cond_t queue_cv;
+    struct ptr_ring queue;                  /* due targets for the workers */
+    struct ptr_ring done;                   /* finished targets for the scheduler */
+    int active;                             /* targets with probes left to run */
+    struct timing_wheel wheel;
+    struct lat_hist lateness;
+    double sched_time;
+    unsigned long sched_ops;
+    int stop;
+    int wake_fd;                            /* eventfd, workers poke the scheduler */
+    pthread_t workers[DAEMON_THREADS_MAX];
+    int nworkers;
+    int running;                            /* workers yet to exit after stop */
+    pthread_cond_t exit_cv;
+};
+
+static volatile sig_atomic_t daemon_stop_requested = 0;
+
+
+static void daemon_signal(int sig)
+{
+    (void) sig;
+    daemon_stop_requested = 1;
+}
+
+
+/* "PATH INTERVAL BLOCK_SIZE lock|nolock osync|none", '#' starts a comment */
+static int probe_target_parse(struct probe_target *t, char *line, const char *where)
+{
+    char *field[5], *save = NULL, *tok;
+    int n = 0;
+    long v;
+
+    for (tok = strtok_r(line, " \t\r\n", &save); tok && n < 5; tok = strtok_r(NULL, " \t\r\n", &save))
+        field[n++] = tok;
+    if ((n != 5) || strtok_r(NULL, " \t\r\n", &save)) {
+        fprintf(stderr, "%s: expecting PATH INTERVAL BLOCK_SIZE lock|nolock osync|none\n", where);
+        return -1;
+    }
+    memset(t, 0, sizeof(*t));
+    if (strlen(field[0]) >= sizeof(t->path)) {
+        fprintf(stderr, "%s: path too long\n", where);
+        return -1;
+    }
+    strcpy(t->path, field[0]);
+    v = atol(field[1]);
+    if ((v < 1) || (v > (long) INTERVAL_MAX)) {
+        fprintf(stderr, "%s: invalid interval %s\n", where, field[1]);
+        return -1;
+    }
+    t->interval = (int) v;
+    v = atol(field[2]);
+    if (((v == 0) && (strcmp(field[2], "0") != 0)) || (v < 0) || (v > (long) BS_MAX)) {
+        fprintf(stderr, "%s: invalid block size %s\n", where, field[2]);
+        return -1;
+    }
+    t->blocksize = (int) v;
+    if (strcmp(field[3], "lock") == 0)
+        t->excl_lock = 1;
+    else if (strcmp(field[3], "nolock") != 0) {
+        fprintf(stderr, "%s: invalid lock mode %s\n", where, field[3]);
+        return -1;
+    }
+    if (strcmp(field[4], "osync") == 0)
+        t->durability = DURABILITY_OSYNC;
+    else if (strcmp(field[4], "none") == 0)
+        t->durability = DURABILITY_NONE;
+    else {
+        fprintf(stderr, "%s: invalid durability %s\n", where, field[4]);
+        return -1;
+    }
+    t->fd = -1;
+    hist_init(&t->hist);
+    return 0;
+}
+
+
+static int daemon_load_targets(struct probe_daemon *d, const char *config)
+{
+    char line[PATH_MAX + 128], where[PATH_MAX + 32];
+    int lineno = 0, cap = 0;
+    FILE *f;
+
+    if ((f = fopen(config, "r")) == NULL) {
+        fprintf(stderr, "Unable to open %s : %s\n", config, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line + strspn(line, " \t");
+
+        lineno++;
+        if ((*p == '#') || (*p == '\n') || (*p == '\0'))
+            continue;
+        if (d->ntargets == cap) {
+            cap = cap ? cap * 2 : 64;
+            d->targets = realloc(d->targets, sizeof(*d->targets) * cap);
+        }
+        snprintf(where, sizeof(where), "%s:%d", config, lineno);
+        if (probe_target_parse(&d->targets[d->ntargets], p, where) == -1) {
+            fclose(f);
+            return -1;
+        }
+        d->ntargets++;
+    }
+    fclose(f);
+    if (d->ntargets == 0) {
+        fprintf(stderr, "No targets in %s\n", config);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* open on first use and again after any failure, truncating only the first time */
+static int probe_target_open(struct probe_target *t)
+{
+    int flags = O_WRONLY|O_CREAT|(t->durability == DURABILITY_OSYNC ? O_SYNC : 0);
+
+    if (!t->truncated)
+        flags |= O_TRUNC;
+    else
+        flags |= O_APPEND;
+    if ((t->fd = open(t->path, flags, (mode_t) 0666)) == -1)
+        return errno;
+    // a canary must not queue behind another lock holder, so never block
+    if (t->excl_lock && (flock(t->fd, LOCK_EX|LOCK_NB) == -1)) {
+        int _errno = errno;
+        close(t->fd);
+        t->fd = -1;
+        return _errno;
+    }
+    t->truncated = 1;
+    return 0;
+}
+
+
+/* one probe write, run on a worker thread without the daemon lock */
+static int probe_target_write(struct probe_target *t, double *latency)
+{
+    size_t write_actual;
+    ssize_t ws;
+    double start;
+    int _errno;
+
+    if ((t->fd == -1) && ((_errno = probe_target_open(t)) != 0))
+        return _errno;
+    write_actual = payload_header(t->buf, (int) t->seq, t->blocksize);
+    start = now_mono();
+    ws = write(t->fd, t->buf, write_actual);
+    *latency = now_mono() - start;
+    if (ws == (ssize_t) write_actual)
+        return 0;
+    _errno = ws == -1 ? errno : EIO;
+    close(t->fd);
+    t->fd = -1;
+    return _errno;
+}
+
+
+/* account for a finished probe and schedule the next one, daemon lock held */
+static void probe_target_complete(struct probe_target *t, int _errno, double latency)
+{
+    double delay = t->interval;
+
+    t->in_flight = 0;
+    t->seq++;
+    if (_errno == 0) {
+        t->writes++;
+        t->streak = 0;
+        t->backoff = 0;
+        t->last_latency = latency;
+        hist_record(&t->hist, latency);
+    } else {
+        t->failures++;
+        t->streak++;
+        t->last_errno = _errno;
+        // exponential backoff on consecutive failures, capped at INTERVAL_MAX
+        delay = (double) t->interval * (1 << (t->streak < 6 ? t->streak : 6));
+        if (delay > INTERVAL_MAX)
+            delay = INTERVAL_MAX;
+        t->backoff = (int) delay - t->interval;
+        fprintf(stderr, "%s: write failed with errno %d (%s), %lu in a row, next try in %.0lf s\n",
+            t->path,
+            _errno,
+            strerror(_errno),
+            t->streak,
+            delay);
+    }
+    // deadlines that passed while the probe was still running are skipped, not queued
+    t->next_due += delay;
+    for (double now = now_mono(); t->next_due < now; t->next_due += delay)
+        t->missed++;
+}
+
+
+static void *daemon_worker_main(void *arg)
+{
+    struct probe_daemon *d = arg;
+    struct probe_target *t;
+    uint64_t one = 1;
+    double latency = 0;
+    int _errno;
+
+    for (;;) {
+        pthread_mutex_lock(&d->lock);
+        while ((d->queue.len == 0) && !d->stop)
+            pthread_cond_wait(&d->queue_cv, &d->lock);
+        if (d->stop) {
+            d->running--;
+            pthread_cond_broadcast(&d->exit_cv);
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+        t = ptr_ring_pop(&d->queue);
+        pthread_mutex_unlock(&d->lock);
+
+        _errno = probe_target_write(t, &latency);
+
+        pthread_mutex_lock(&d->lock);
+        probe_target_complete(t, _errno, latency);
+        ptr_ring_push(&d->done, t);
+        pthread_mutex_unlock(&d->lock);
+        if (write(d->wake_fd, &one, sizeof(one)) == -1) {
+            // the counter can't overflow at one poke per probe, nothing to do
+        }
+    }
+    return NULL;
+}
+
+
+/* queue a due target for the workers, daemon lock held */
+static void daemon_dispatch(struct probe_daemon *d, struct probe_target *t)
+{
+    t->in_flight = 1;
+    ptr_ring_push(&d->queue, t);
+    pthread_cond_signal(&d->queue_cv);
+}
+
+
+/* src as a Prometheus label value: backslash, double quote and newline escaped */
+static void prom_label_escape(char *dst, size_t size, const char *src)
+{
+    size_t n = 0;
+
+    for (; *src && (n + 2 < size); src++) {
+        if ((*src == '\\') || (*src == '"'))
+            dst[n++] = '\\';
+        else if (*src == '\n') {
+            dst[n++] = '\\';
+            dst[n++] = 'n';
+            continue;
+        }
+        dst[n++] = *src;
+    }
+    dst[n] = '\0';
+}
+
+
+/* Prometheus text exposition of every target, replaced atomically */
+static void daemon_export_metrics(struct probe_daemon *d)
+{
+    char tmp[PATH_MAX + 8], path[2 * PATH_MAX];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", d->metrics_file);
+    if ((f = fopen(tmp, "w")) == NULL) {
+        fprintf(stderr, "Unable to write %s : %s\n", tmp, strerror(errno));
+        return;
+    }
+    fprintf(f, "# TYPE timed_writer_writes_total counter\n");
+    fprintf(f, "# TYPE timed_writer_failures_total counter\n");
+    fprintf(f, "# TYPE timed_writer_missed_total counter\n");
+    fprintf(f, "# TYPE timed_writer_failure_streak gauge\n");
+    fprintf(f, "# TYPE timed_writer_backoff_seconds gauge\n");
+    fprintf(f, "# TYPE timed_writer_in_flight gauge\n");
+    fprintf(f, "# TYPE timed_writer_last_latency_seconds gauge\n");
+    fprintf(f, "# TYPE timed_writer_latency_seconds summary\n");
+    pthread_mutex_lock(&d->lock);
+    for (int i = 0; i < d->ntargets; i++) {
+        struct probe_target *t = &d->targets[i];
+
+        prom_label_escape(path, sizeof(path), t->path);
+        fprintf(f, "timed_writer_writes_total{path=\"%s\"} %lu\n", path, t->writes);
+        fprintf(f, "timed_writer_failures_total{path=\"%s\"} %lu\n", path, t->failures);
+        fprintf(f, "timed_writer_missed_total{path=\"%s\"} %lu\n", path, t->missed);
+        fprintf(f, "timed_writer_failure_streak{path=\"%s\"} %lu\n", path, t->streak);
+        fprintf(f, "timed_writer_backoff_seconds{path=\"%s\"} %d\n", path, t->backoff);
+        fprintf(f, "timed_writer_in_flight{path=\"%s\"} %d\n", path, t->in_flight);
+        fprintf(f, "timed_writer_last_latency_seconds{path=\"%s\"} %.6lf\n", path, t->last_latency);
+        fprintf(f, "timed_writer_latency_seconds{path=\"%s\",quantile=\"0.5\"} %.6lf\n",
+            path, hist_percentile(&t->hist, 50));
+        fprintf(f, "timed_writer_latency_seconds{path=\"%s\",quantile=\"0.99\"} %.6lf\n",
+            path, hist_percentile(&t->hist, 99));
+        fprintf(f, "timed_writer_latency_seconds_sum{path=\"%s\"} %.6lf\n", path, t->hist.sum);
+        fprintf(f, "timed_writer_latency_seconds_count{path=\"%s\"} %lu\n", path, t->hist.count);
+    }
+    pthread_mutex_unlock(&d->lock);
+    if ((fclose(f) != 0) || (rename(tmp, d->metrics_file) == -1))
+        fprintf(stderr, "Unable to publish %s : %s\n", d->metrics_file, strerror(errno));
+}
+
+
+/* timing wheel callback, daemon lock held */
+static void daemon_timer_fired(struct wheel_timer *timer, void *arg)
+{
+    struct probe_daemon *d = arg;
+    struct probe_target *t = (struct probe_target *) ((char *) timer - offsetof(struct probe_target, timer));
+
+    hist_record(&d->lateness, now_mono() - t->next_due);
+    daemon_dispatch(d, t);
+}
+
+
+/* put targets finished by the workers back on the wheel, daemon lock held */
+static void daemon_reschedule(struct probe_daemon *d)
+{
+    while (d->done.len) {
+        struct probe_target *t = ptr_ring_pop(&d->done);
+
+        if (d->max_iter && (t->seq >= (unsigned long) d->max_iter))
+            d->active--;
+        else {
+            wheel_add(&d->wheel, &t->timer, wheel_tick(&d->wheel, t->next_due));
+            d->sched_ops++;
+        }
+    }
+}
+
+
+int daemon_run(struct probe_daemon *d)
+{
+    struct sigaction sa;
+    struct pollfd pfd[2];
+    struct rusage ru;
+    struct timespec until;
+    pthread_condattr_t attr;
+    double now, t, next_export;
+    uint64_t events;
+    int timeout, stuck;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = daemon_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->queue_cv, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&d->exit_cv, &attr);
+    pthread_condattr_destroy(&attr);
+    if ((ptr_ring_init(&d->queue, d->ntargets) == -1) || (ptr_ring_init(&d->done, d->ntargets) == -1)) {
+        fprintf(stderr, "Unable to allocate %d target queue\n", d->ntargets);
+        return 1;
+    }
+    hist_init(&d->lateness);
+    if ((d->wake_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1) {
+        fprintf(stderr, "eventfd() failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (wheel_init(&d->wheel) == -1) {
+        fprintf(stderr, "timerfd_create() failed: %s\n", strerror(errno));
+        return 1;
+    }
+    // spread first probes over the first second so hundreds of targets don't fire at once
+    now = now_mono();
+    for (int i = 0; i < d->ntargets; i++) {
+        struct probe_target *t = &d->targets[i];
+
+        t->buf_size = t->blocksize > BS_DEF ? (size_t) t->blocksize : (size_t) BS_DEF;
+        t->buf = malloc(t->buf_size);
+        memset(t->buf, '\r', t->buf_size);
+        t->next_due = now + (double) i / d->ntargets;
+        wheel_add(&d->wheel, &t->timer, wheel_tick(&d->wheel, t->next_due));
+    }
+    d->active = d->ntargets;
+    d->sched_time = now_mono() - now;
+    d->sched_ops = (unsigned long) d->ntargets;
+    wheel_arm(&d->wheel);
+    for (int i = 0; i < d->nworkers; i++)
+        if (pthread_create(&d->workers[i], NULL, daemon_worker_main, d) != 0) {
+            fprintf(stderr, "Unable to start worker thread %d\n", i);
+            return 1;
+        }
+    d->running = d->nworkers;
+    printf("Probing %d targets with %d worker threads\n", d->ntargets, d->nworkers);
+    fflush(stdout);
+
+    next_export = now + d->export_interval;
+    pfd[0].fd = d->wheel.timerfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = d->wake_fd;
+    pfd[1].events = POLLIN;
+    while (!daemon_stop_requested && d->active) {
+        timeout = -1;
+        if (d->metrics_file) {
+            timeout = (int) ((next_export - now_mono()) * 1000) + 1;
+            if (timeout < 0)
+                timeout = 0;
+        }
+        if (poll(pfd, 2, timeout) == -1)
+            continue;
+
+        if ((pfd[0].revents & POLLIN) && (read(d->wheel.timerfd, &events, sizeof(events)) == -1)) {
+            // EAGAIN, spurious wakeup
+        }
+        if ((pfd[1].revents & POLLIN) && (read(d->wake_fd, &events, sizeof(events)) == -1)) {
+            // EAGAIN, another wakeup already drained the counter
+        }
+        t = now_mono();
+        pthread_mutex_lock(&d->lock);
+        daemon_reschedule(d);
+        d->sched_ops += wheel_advance(&d->wheel, wheel_tick(&d->wheel, t) - 1, daemon_timer_fired, d);
+        wheel_arm(&d->wheel);
+        pthread_mutex_unlock(&d->lock);
+        d->sched_time += now_mono() - t;
+
+        if (d->metrics_file && (now_mono() >= next_export)) {
+            daemon_export_metrics(d);
+            next_export = now_mono() + d->export_interval;
+        }
+    }
+
+    // a second signal ends the daemon at once
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /*
+        a worker stuck in write() on a hung mount never comes back, so
+        give the workers DAEMON_GRACE seconds, then report what is still
+        in flight and leave without joining or freeing what they use
+    */
+    pthread_mutex_lock(&d->lock);
+    d->stop = 1;
+    pthread_cond_broadcast(&d->queue_cv);
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += DAEMON_GRACE;
+    while (d->running && (pthread_cond_timedwait(&d->exit_cv, &d->lock, &until) != ETIMEDOUT))
+        ;
+    stuck = d->running;
+    for (int i = 0; stuck && (i < d->ntargets); i++)
+        if (d->targets[i].in_flight)
+            fprintf(stderr, "%s: probe still running after %d s, abandoning it\n",
+                d->targets[i].path,
+                DAEMON_GRACE);
+    pthread_mutex_unlock(&d->lock);
+    for (int i = 0; !stuck && (i < d->nworkers); i++)
+        pthread_join(d->workers[i], NULL);
+    if (d->metrics_file)
+        daemon_export_metrics(d);
+
+    printf("\n%-40s %8s %8s %7s %7s %10s %10s %10s\n",
+        "target", "writes", "failures", "streak", "missed", "p50 ms", "p99 ms", "max ms");
+    pthread_mutex_lock(&d->lock);
+    for (int i = 0; i < d->ntargets; i++) {
+        struct probe_target *t = &d->targets[i];
+
+        printf("%-40s %8lu %8lu %7lu %7lu %10.3lf %10.3lf %10.3lf\n",
+            t->path,
+            t->writes,
+            t->failures,
+            t->streak,
+            t->missed,
+            hist_percentile(&t->hist, 50) * 1000,
+            hist_percentile(&t->hist, 99) * 1000,
+            t->hist.max * 1000);
+    }
+    pthread_mutex_unlock(&d->lock);
+    getrusage(RUSAGE_THREAD, &ru);
+    printf("\nScheduler: %lu timer operations in %.6lf s (%.0lf ns each), thread cpu user %.3lf s sys %.3lf s\n",
+        d->sched_ops,
+        d->sched_time,
+        d->sched_ops ? d->sched_time / d->sched_ops * 1000000000 : 0,
+        (double) ru.ru_utime.tv_sec + (double) ru.ru_utime.tv_usec / 1000000,
+        (double) ru.ru_stime.tv_sec + (double) ru.ru_stime.tv_usec / 1000000);
+    hist_print("deadline lateness", &d->lateness);
+    if (stuck) {
+        printf("%d worker%s still probing, exiting without waiting\n", stuck, stuck == 1 ? "" : "s");
+        fflush(stdout);
+        _exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < d->ntargets; i++) {
+        if (d->targets[i].fd != -1)
+            close(d->targets[i].fd);
+        free(d->targets[i].buf);
+    }
+    close(d->wake_fd);
+    wheel_destroy(&d->wheel);
+    ptr_ring_free(&d->done);
+    ptr_ring_free(&d->queue);
+    free(d->targets);
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->queue_cv);
+    pthread_cond_destroy(&d->exit_cv);
+    return 0;
+}
+
+
+/* load CONFIG and probe its targets until done or signalled */
+int daemon_probe(const char *config, int max_iter, int nworkers, const char *metrics_file, int export_interval)
+{
+    struct probe_daemon d;
+
+    memset(&d, 0, sizeof(d));
+    d.max_iter = max_iter;
+    d.nworkers = nworkers;
+    d.metrics_file = metrics_file;
+    d.export_interval = export_interval;
+    if (daemon_load_targets(&d, config) == -1)
+        return 1;
+    return daemon_run(&d);
+}
+
+
+/*
+    compare subcommand: A/B writes to two targets, given in the daemon's
+    CONFIG line format, within one run.  Each pair writes the same
+    sequence's block to A and B back to back, A first on even pairs and B
+    first on odd ones (or in random order), so drift over the run hits
+    both sides alike.  Pairs where both writes succeeded are tested with
+    the Wilcoxon signed-rank test, normal approximation with tie
+    correction, on the latency differences A - B.
+*/
+struct compare_rank {
+    double abs;
+    int sign;
+};
+
+
+static int compare_rank_cmp(const void *a, const void *b)
+{
+    double x = ((const struct compare_rank *) a)->abs, y = ((const struct compare_rank *) b)->abs;
+
+    return (x > y) - (x < y);
+}
+
+
+static int compare_double_cmp(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* two-sided p of the signed-rank statistic for d[0..n), sets *w_plus */
+static double wilcoxon_signed_rank(const double *d, int n, double *w_plus, int *used)
+{
+    struct compare_rank *r = malloc(sizeof(*r) * (n ? n : 1));
+    double var, z, ties = 0;
+    int m = 0;
+
+    // zero differences carry no sign and are dropped
+    for (int i = 0; i < n; i++)
+        if (d[i] != 0) {
+            r[m].abs = fabs(d[i]);
+            r[m].sign = d[i] > 0 ? 1 : -1;
+            m++;
+        }
+    qsort(r, (size_t) m, sizeof(*r), compare_rank_cmp);
+    *w_plus = 0;
+    for (int i = 0, j; i < m; i = j) {
+        double rank, t;
+
+        for (j = i + 1; (j < m) && (r[j].abs == r[i].abs); j++)
+            ;
+        rank = (double) (i + 1 + j) / 2;
+        t = j - i;
+        ties += t * t * t - t;
+        for (int k = i; k < j; k++)
+            if (r[k].sign > 0)
+                *w_plus += rank;
+    }
+    free(r);
+    *used = m;
+    if (m == 0)
+        return 1;
+    var = (double) m * (m + 1) * (2 * m + 1) / 24 - ties / 48;
+    z = (*w_plus - (double) m * (m + 1) / 4) / sqrt(var);
+    return erfc(fabs(z) / sqrt(2));
+}
+
+
+int compare_targets(const char *spec_a, const char *spec_b, int pairs, int interval, int random, int quiet)
+{
+    struct probe_target t[2];
+    char line[PATH_MAX + 128];
+    const char *spec[2] = { spec_a, spec_b }, *name[2] = { "A", "B" };
+    double *lat[2], *d, latency, w_plus, p, mean = 0, sd = 0, median;
+    unsigned int seed = (unsigned int) getpid() ^ (unsigned int) (now_real() * 1000);
+    int npaired = 0, used, a_wins = 0, first, rc = 0;
+
+    for (int k = 0; k < 2; k++) {
+        snprintf(line, sizeof(line), "%s", spec[k]);
+        if (probe_target_parse(&t[k], line, name[k]) == -1)
+            return 1;
+        t[k].buf_size = t[k].blocksize > BS_DEF ? (size_t) t[k].blocksize : (size_t) BS_DEF;
+        t[k].buf = malloc(t[k].buf_size);
+        memset(t[k].buf, '\r', t[k].buf_size);
+        lat[k] = malloc(sizeof(double) * (size_t) pairs);
+    }
+    if (interval < 0) {
+        if (t[0].interval != t[1].interval) {
+            fprintf(stderr, "A and B must share a schedule, give both the same INTERVAL or use -s\n");
+            return 1;
+        }
+        interval = t[0].interval;
+    }
+    d = malloc(sizeof(double) * (size_t) pairs);
+
+    for (int k = 0; k < 2; k++)
+        printf("%s: %s, %d byte writes%s, %s, %s\n",
+            name[k],
+            t[k].path,
+            t[k].blocksize,
+            t[k].blocksize ? "" : " (sequence lines)",
+            t[k].excl_lock ? "LOCK_EX" : "no lock",
+            t[k].durability == DURABILITY_OSYNC ? "O_SYNC" : "no O_SYNC");
+    printf("Pairs: %d, %d s apart, %s order", pairs, interval, random ? "random" : "alternating");
+    if (random)
+        printf(" (seed %u)", seed);
+    printf("\n");
+
+    for (int i = 0; i < pairs; i++) {
+        int ok[2];
+
+        first = random ? (int) (rand_r(&seed) & 1) : i & 1;
+        for (int n = 0; n < 2; n++) {
+            int k = n ? !first : first;
+            int _errno = probe_target_write(&t[k], &latency);
+
+            t[k].seq++;
+            ok[k] = _errno == 0;
+            if (ok[k]) {
+                hist_record(&t[k].hist, latency);
+                lat[k][npaired] = latency;
+                t[k].writes++;
+            } else {
+                t[k].failures++;
+                fprintf(stderr, "Pair %d: %s write failed with errno %d (%s)\n",
+                    i, name[k], _errno, strerror(_errno));
+            }
+        }
+        if (ok[0] && ok[1]) {
+            if (!quiet)
+                printf("Pair %d (%s%s): A %.3lf ms; B %.3lf ms\n",
+                    i,
+                    name[first],
+                    name[!first],
+                    lat[0][npaired] * 1000,
+                    lat[1][npaired] * 1000);
+            d[npaired] = lat[0][npaired] - lat[1][npaired];
+            npaired++;
+        }
+        if (i + 1 < pairs)
+            sleep_for(interval);
+    }
+
+    printf("\n");
+    for (int k = 0; k < 2; k++) {
+        hist_print(name[k], &t[k].hist);
+        if (t[k].failures)
+            printf("%s failures: %lu\n", name[k], t[k].failures);
+        if (t[k].fd != -1)
+            close(t[k].fd);
+        free(t[k].buf);
+    }
+    if (npaired == 0) {
+        printf("Verdict: no pair where both writes succeeded\n");
+        rc = 1;
+        goto out;
+    }
+
+    for (int i = 0; i < npaired; i++) {
+        mean += d[i];
+        a_wins += d[i] < 0;
+    }
+    mean /= npaired;
+    for (int i = 0; i < npaired; i++)
+        sd += (d[i] - mean) * (d[i] - mean);
+    sd = npaired > 1 ? sqrt(sd / (npaired - 1)) : 0;
+    p = wilcoxon_signed_rank(d, npaired, &w_plus, &used);
+    qsort(d, (size_t) npaired, sizeof(double), compare_double_cmp);
+    median = npaired & 1 ? d[npaired / 2] : (d[npaired / 2 - 1] + d[npaired / 2]) / 2;
+
+    printf("Paired A - B over %d pairs: mean %.3lf ms (95%% CI %.3lf .. %.3lf), median %.3lf ms\n",
+        npaired,
+        mean * 1000,
+        (mean - 1.96 * sd / sqrt(npaired)) * 1000,
+        (mean + 1.96 * sd / sqrt(npaired)) * 1000,
+        median * 1000);
+    printf("A faster in %d pairs, B faster in %d\n", a_wins, used - a_wins);
+    printf("Wilcoxon signed-rank: W+ %.1lf over %d non-zero pairs, p %.4lf\n", w_plus, used, p);
+    if (used < COMPARE_MIN_PAIRS)
+        printf("Warning: fewer than %d non-zero pairs, the normal approximation is rough\n", COMPARE_MIN_PAIRS);
+    if (p < COMPARE_ALPHA)
+        printf("Verdict: %s is faster (p < %.2lf)\n", w_plus < (double) used * (used + 1) / 4 ? "A" : "B",
+            COMPARE_ALPHA);
+    else
+        printf("Verdict: no significant difference (p >= %.2lf)\n", COMPARE_ALPHA);
+out:
+    free(d);
+    free(lat[0]);
+    free(lat[1]);
+    return rc;
+}
+
+
+/*
+    report subcommand: render a trace (-t, or a flight recorder dump) as
+    one self-contained HTML file with inline SVG and no scripts: a heatmap
+    of latency buckets over time, CDFs of the whole run and of each
+    quarter of it, and throughput and failures per time window.  Latency
+    rows are the lat_hist buckets, so the heatmap reads like the
+    histograms printed at the end of a run.
+*/
+struct trace_row {
+    double when;
+    double latency;
+    long bytes;
+    int err;
+};
+
+
+/* read rows from a CSV with time, errno, bytes and latency columns, any order */
+static struct trace_row *trace_load(const char *path, int *nrows)
+{
+    char line[1024], *tok, *save;
+    int col_time = -1, col_err = -1, col_bytes = -1, col_lat = -1, cap = 0, n = 0;
+    struct trace_row *rows = NULL;
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "Unable to open %s : %s\n", path, strerror(errno));
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        struct trace_row r;
+        int col = 0, seen = 0;
+
+        if ((line[0] == '#') || (line[0] == '\n'))
+            continue;
+        if (col_time == -1) {
+            for (tok = strtok_r(line, ",\r\n", &save); tok; tok = strtok_r(NULL, ",\r\n", &save), col++) {
+                if (strcmp(tok, "time") == 0)
+                    col_time = col;
+                else if (strcmp(tok, "errno") == 0)
+                    col_err = col;
+                else if (strcmp(tok, "bytes") == 0)
+                    col_bytes = col;
+                else if (strcmp(tok, "latency") == 0)
+                    col_lat = col;
+            }
+            if ((col_time == -1) || (col_err == -1) || (col_bytes == -1) || (col_lat == -1)) {
+                fprintf(stderr, "%s: expecting a header with time, errno, bytes and latency\n", path);
+                fclose(f);
+                return NULL;
+            }
+            continue;
+        }
+        for (tok = strtok_r(line, ",\r\n", &save); tok; tok = strtok_r(NULL, ",\r\n", &save), col++) {
+            if (col == col_time)
+                r.when = atof(tok);
+            else if (col == col_err)
+                r.err = atoi(tok);
+            else if (col == col_bytes)
+                r.bytes = atol(tok);
+            else if (col == col_lat)
+                r.latency = atof(tok);
+            else
+                continue;
+            seen++;
+        }
+        if (seen != 4)
+            continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            rows = realloc(rows, sizeof(*rows) * cap);
+        }
+        rows[n++] = r;
+    }
+    fclose(f);
+    if (n == 0) {
+        fprintf(stderr, "%s: no trace rows\n", path);
+        free(rows);
+        return NULL;
+    }
+    *nrows = n;
+    return rows;
+}
+
+
+/* white through yellow and orange to dark red */
+static void report_color(double t, char *buf, size_t size)
+{
+    static const int stop[5][3] = {
+        { 255, 255, 255 }, { 255, 237, 160 }, { 254, 178, 76 }, { 240, 59, 32 }, { 128, 0, 38 }
+    };
+    double x = t * 4;
+    int i = x >= 4 ? 3 : (int) x;
+    double f = x - i;
+
+    snprintf(buf, size, "#%02x%02x%02x",
+        (int) (stop[i][0] + (stop[i + 1][0] - stop[i][0]) * f),
+        (int) (stop[i][1] + (stop[i + 1][1] - stop[i][1]) * f),
+        (int) (stop[i][2] + (stop[i + 1][2] - stop[i][2]) * f));
+}
+
+
+static void report_latency_label(char *buf, size_t size, double seconds)
+{
+    if (seconds >= 1)
+        snprintf(buf, size, "%g s", seconds);
+    else if (seconds >= 0.001)
+        snprintf(buf, size, "%g ms", seconds * 1000);
+    else
+        snprintf(buf, size, "%g us", seconds * 1000000);
+}
+
+
+/* column of a row; clamped, so a bad time can only land in an edge column */
+static int report_column(const struct trace_row *row, double start, double window, int ncols)
+{
+    double c = (row->when - start) / window;
+
+    if (!(c >= 0))
+        return 0;
+    return c < ncols ? (int) c : ncols - 1;
+}
+
+
+static void report_heatmap(FILE *out, const struct trace_row *rows, int n, double start, double window, int ncols)
+{
+    int lo = HIST_BUCKETS, hi = 0, nb, max = 0, *cell;
+    double cw, ch;
+    char color[8], label[32];
+
+    for (int i = 0; i < n; i++)
+        if (!rows[i].err) {
+            int b = hist_index((unsigned long long) (rows[i].latency * 1000000));
+
+            lo = b < lo ? b : lo;
+            hi = b > hi ? b : hi;
+        }
+    if (lo > hi)
+        return;
+    nb = hi - lo + 1;
+    cell = calloc((size_t) ncols * nb, sizeof(int));
+    for (int i = 0; i < n; i++)
+        if (!rows[i].err) {
+            int c = report_column(&rows[i], start, window, ncols);
+            int b = hist_index((unsigned long long) (rows[i].latency * 1000000)) - lo;
+
+            if (++cell[c * nb + b] > max)
+                max = cell[c * nb + b];
+        }
+    cw = (double) REPORT_WIDTH / ncols;
+    ch = (double) REPORT_HEIGHT / nb;
+
+    fprintf(out, "<h2>Latency heatmap</h2>\n");
+    fprintf(out, "<svg width=\"%d\" height=\"%d\" font-size=\"11\">\n",
+        REPORT_WIDTH + REPORT_MARGIN * 2, REPORT_HEIGHT + REPORT_MARGIN * 2);
+    fprintf(out, "<g transform=\"translate(%d,%d)\">\n", REPORT_MARGIN, REPORT_MARGIN);
+    fprintf(out, "<rect width=\"%d\" height=\"%d\" fill=\"#fff\" stroke=\"#999\"/>\n", REPORT_WIDTH, REPORT_HEIGHT);
+    for (int c = 0; c < ncols; c++)
+        for (int b = 0; b < nb; b++) {
+            int v = cell[c * nb + b];
+
+            if (!v)
+                continue;
+            // colour by log count so a lone outlier still shows next to a busy bucket
+            report_color(log1p(v) / log1p(max), color, sizeof(color));
+            fprintf(out, "<rect x=\"%.2lf\" y=\"%.2lf\" width=\"%.2lf\" height=\"%.2lf\" fill=\"%s\">"
+                "<title>%d writes</title></rect>\n",
+                c * cw, REPORT_HEIGHT - (b + 1) * ch, cw + 0.5, ch + 0.5, color, v);
+        }
+    // decades of latency on the left, elapsed time underneath
+    for (double v = 0.000001; v <= 100; v *= 10) {
+        int b = hist_index((unsigned long long) (v * 1000000));
+
+        if ((b < lo) || (b > hi))
+            continue;
+        report_latency_label(label, sizeof(label), v);
+        fprintf(out, "<text x=\"-4\" y=\"%.1lf\" text-anchor=\"end\">%s</text>\n",
+            REPORT_HEIGHT - (b - lo + 0.5) * ch + 4, label);
+    }
+    for (int i = 0; i <= 5; i++)
+        fprintf(out, "<text x=\"%.1lf\" y=\"%d\" text-anchor=\"middle\">%.3g s</text>\n",
+            (double) REPORT_WIDTH * i / 5, REPORT_HEIGHT + 14, window * ncols * i / 5);
+    fprintf(out, "</g>\n</svg>\n");
+    fprintf(out, "<p>%.3g s columns, %d writes in the busiest cell</p>\n", window, max);
+    free(cell);
+}
+
+
+static void report_cdf(FILE *out, const struct trace_row *rows, int n)
+{
+    static const char *colors[] = { "#000", "#1b9e77", "#d95f02", "#7570b3", "#e7298a" };
+    double *lat = malloc(sizeof(double) * n), lmin, lmax, span;
+    int m = 0, from, to;
+    char label[32];
+
+    for (int i = 0; i < n; i++)
+        if (!rows[i].err)
+            m++;
+    if (m == 0) {
+        free(lat);
+        return;
+    }
+    lmin = 1e9;
+    lmax = 0;
+    for (int i = 0; i < n; i++)
+        if (!rows[i].err) {
+            double v = rows[i].latency > 0.000001 ? rows[i].latency : 0.000001;
+
+            lmin = v < lmin ? v : lmin;
+            lmax = v > lmax ? v : lmax;
+        }
+    lmin = pow(10, floor(log10(lmin)));
+    lmax = pow(10, ceil(log10(lmax)));
+    span = log10(lmax) - log10(lmin);
+
+    fprintf(out, "<h2>Latency CDF</h2>\n");
+    fprintf(out, "<svg width=\"%d\" height=\"%d\" font-size=\"11\">\n",
+        REPORT_WIDTH + REPORT_MARGIN * 2, REPORT_HEIGHT + REPORT_MARGIN * 2);
+    fprintf(out, "<g transform=\"translate(%d,%d)\">\n", REPORT_MARGIN, REPORT_MARGIN);
+    fprintf(out, "<rect width=\"%d\" height=\"%d\" fill=\"#fff\" stroke=\"#999\"/>\n", REPORT_WIDTH, REPORT_HEIGHT);
+    for (double v = lmin; v <= lmax * 1.01; v *= 10) {
+        double x = (log10(v) - log10(lmin)) / span * REPORT_WIDTH;
+
+        report_latency_label(label, sizeof(label), v);
+        fprintf(out, "<line x1=\"%.1lf\" x2=\"%.1lf\" y1=\"0\" y2=\"%d\" stroke=\"#ddd\"/>\n", x, x, REPORT_HEIGHT);
+        fprintf(out, "<text x=\"%.1lf\" y=\"%d\" text-anchor=\"middle\">%s</text>\n", x, REPORT_HEIGHT + 14, label);
+    }
+    for (int i = 0; i <= 4; i++)
+        fprintf(out, "<text x=\"-4\" y=\"%.1lf\" text-anchor=\"end\">%d%%</text>\n",
+            REPORT_HEIGHT - (double) REPORT_HEIGHT * i / 4 + 4, i * 25);
+
+    // the whole run, then each quarter of it to show drift
+    for (int curve = 0; curve < 5; curve++) {
+        from = curve ? n * (curve - 1) / 4 : 0;
+        to = curve ? n * curve / 4 : n;
+        m = 0;
+        for (int i = from; i < to; i++)
+            if (!rows[i].err)
+                lat[m++] = rows[i].latency > 0.000001 ? rows[i].latency : 0.000001;
+        if (m == 0)
+            continue;
+        qsort(lat, (size_t) m, sizeof(double), compare_double_cmp);
+        fprintf(out, "<polyline fill=\"none\" stroke=\"%s\" stroke-width=\"%s\" points=\"",
+            colors[curve], curve ? "1" : "2");
+        for (int p = 0; p <= REPORT_CDF_POINTS; p++) {
+            int i = (int) ((double) (m - 1) * p / REPORT_CDF_POINTS);
+
+            fprintf(out, "%.1lf,%.1lf ",
+                (log10(lat[i]) - log10(lmin)) / span * REPORT_WIDTH,
+                REPORT_HEIGHT - (double) (i + 1) / m * REPORT_HEIGHT);
+        }
+        fprintf(out, "\"/>\n");
+        fprintf(out, "<text x=\"8\" y=\"%d\" fill=\"%s\">%s</text>\n",
+            14 + curve * 14, colors[curve], curve == 0 ? "whole run" :
+            curve == 1 ? "1st quarter" : curve == 2 ? "2nd quarter" : curve == 3 ? "3rd quarter" : "4th quarter");
+    }
+    fprintf(out, "</g>\n</svg>\n");
+    free(lat);
+}
+
+
+static void report_throughput(FILE *out, const struct trace_row *rows, int n, double start, double window, int ncols)
+{
+    double *mib = calloc((size_t) ncols, sizeof(double)), top = 0;
+    int *fails = calloc((size_t) ncols, sizeof(int));
+
+    for (int i = 0; i < n; i++) {
+        int c = report_column(&rows[i], start, window, ncols);
+
+        if (rows[i].err)
+            fails[c]++;
+        else
+            mib[c] += (double) rows[i].bytes / (1024 * 1024) / window;
+    }
+    for (int c = 0; c < ncols; c++)
+        top = mib[c] > top ? mib[c] : top;
+    if (top == 0)
+        top = 1;
+
+    fprintf(out, "<h2>Throughput</h2>\n");
+    fprintf(out, "<svg width=\"%d\" height=\"%d\" font-size=\"11\">\n",
+        REPORT_WIDTH + REPORT_MARGIN * 2, REPORT_HEIGHT / 2 + REPORT_MARGIN * 2);
+    fprintf(out, "<g transform=\"translate(%d,%d)\">\n", REPORT_MARGIN, REPORT_MARGIN);
+    fprintf(out, "<rect width=\"%d\" height=\"%d\" fill=\"#fff\" stroke=\"#999\"/>\n",
+        REPORT_WIDTH, REPORT_HEIGHT / 2);
+    fprintf(out, "<polyline fill=\"none\" stroke=\"#2b8cbe\" stroke-width=\"1.5\" points=\"");
+    for (int c = 0; c < ncols; c++)
+        fprintf(out, "%.1lf,%.1lf ",
+            (c + 0.5) * REPORT_WIDTH / ncols,
+            REPORT_HEIGHT / 2 - mib[c] / top * (REPORT_HEIGHT / 2));
+    fprintf(out, "\"/>\n");
+    for (int c = 0; c < ncols; c++)
+        if (fails[c])
+            fprintf(out, "<rect x=\"%.1lf\" y=\"0\" width=\"%.1lf\" height=\"%d\" fill=\"#e31a1c\" "
+                "fill-opacity=\"0.25\"><title>%d failed writes</title></rect>\n",
+                (double) c * REPORT_WIDTH / ncols, (double) REPORT_WIDTH / ncols, REPORT_HEIGHT / 2, fails[c]);
+    fprintf(out, "<text x=\"-4\" y=\"10\" text-anchor=\"end\">%.2lf</text>\n", top);
+    fprintf(out, "<text x=\"-4\" y=\"%d\" text-anchor=\"end\">0</text>\n", REPORT_HEIGHT / 2);
+    for (int i = 0; i <= 5; i++)
+        fprintf(out, "<text x=\"%.1lf\" y=\"%d\" text-anchor=\"middle\">%.3g s</text>\n",
+            (double) REPORT_WIDTH * i / 5, REPORT_HEIGHT / 2 + 14, window * ncols * i / 5);
+    fprintf(out, "</g>\n</svg>\n");
+    fprintf(out, "<p>MiB/s per %.3g s window; shaded windows had failed writes</p>\n", window);
+    free(mib);
+    free(fails);
+}
+
+
+int report_trace(const char *trace, const char *output, int window)
+{
+    struct trace_row *rows;
+    struct lat_hist h;
+    char path[PATH_MAX], from[40], to[40], line[HIST_LINE_MAX];
+    double start, end, width = window;
+    int n, ncols, failures = 0;
+    FILE *out;
+
+    if ((rows = trace_load(trace, &n)) == NULL)
+        return 1;
+    // wall clock times, so a clock step or an appended -r run can go backwards
+    start = rows[0].when - rows[0].latency;
+    end = rows[0].when;
+    for (int i = 1; i < n; i++) {
+        start = rows[i].when - rows[i].latency < start ? rows[i].when - rows[i].latency : start;
+        end = rows[i].when > end ? rows[i].when : end;
+    }
+    if (!window)
+        width = end > start ? (end - start) / REPORT_COLUMNS : 1;
+    if ((end - start) / width > REPORT_COLUMNS_MAX) {
+        width = (end - start) / REPORT_COLUMNS_MAX;
+        printf("Window widened to %.3g s to keep within %d columns\n", width, REPORT_COLUMNS_MAX);
+    }
+    ncols = (int) ((end - start) / width) + 1;
+    if (!output) {
+        snprintf(path, sizeof(path), "%s.html", trace);
+        output = path;
+    }
+    if ((out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "Unable to open %s : %s\n", output, strerror(errno));
+        free(rows);
+        return 1;
+    }
+
+    hist_init(&h);
+    for (int i = 0; i < n; i++) {
+        if (rows[i].err)
+            failures++;
+        else
+            hist_record(&h, rows[i].latency);
+    }
+    format_real(from, sizeof(from), start);
+    format_real(to, sizeof(to), end);
+    hist_format(line, sizeof(line), "write()", &h);
+
+    fprintf(out, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\">\n");
+    fprintf(out, "<title>timed-writer report: %s</title>\n", trace);
+    fprintf(out, "<style>body{font-family:sans-serif;margin:2em}pre{background:#f4f4f4;padding:.5em}"
+        "svg text{fill:#333}</style>\n</head><body>\n");
+    fprintf(out, "<h1>timed-writer report</h1>\n");
+    fprintf(out, "<p>Trace %s: %s to %s, %d writes, %d failed</p>\n", trace, from, to, n, failures);
+    fprintf(out, "<pre>%s</pre>\n", line);
+    report_heatmap(out, rows, n, start, width, ncols);
+    report_cdf(out, rows, n);
+    report_throughput(out, rows, n, start, width, ncols);
+    fprintf(out, "</body></html>\n");
+    fclose(out);
+    free(rows);
+    printf("Report: %s\n", output);
+    return 0;
+}
+
+
+/*
+    Public probe API, see timedwriter.h.  A probe is a quiet line run
+    kept open between runs; the loop reports each write through on_write
+    so snapshots never read the loop's own state.
+*/
+struct tw_probe {
+    char *filename;
+    double interval;
+    int iterations;
+    struct writer_config wcfg;
+    struct line_state st;
+    line_loop_fn loop;
+    pthread_mutex_t lock;                   /* guards the stats below */
+    struct lat_hist hist;
+    unsigned long failures;
+    unsigned long long bytes;
+    int last_errno;
+    pthread_t thread;
+    int running;
+};
+
+
+static void probe_on_write(void *arg, ssize_t ws, size_t expected, int _errno, double latency)
+{
+    struct tw_probe *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    if (ws == -1) {
+        p->failures++;
+        p->last_errno = _errno;
+    } else if ((size_t) ws != expected) {
+        // short, as the daemon counts it: what did land is still bytes written
+        p->failures++;
+        p->last_errno = EIO;
+        p->bytes += (unsigned long long) ws;
+    } else {
+        hist_record(&p->hist, latency);
+        p->bytes += (unsigned long long) ws;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+
+static void *probe_main(void *arg)
+{
+    struct tw_probe *p = arg;
+
+    p->loop(&p->st);
+    return NULL;
+}
+
+
+int tw_api_version(void)
+{
+    return TW_API_VERSION;
+}
+
+
+void tw_config_init(struct tw_config *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->interval = INTERVAL_DEFAULT;
+    cfg->durability = TW_DURABILITY_OSYNC;
+}
+
+
+struct tw_probe *tw_probe_create(const struct tw_config *cfg)
+{
+    struct tw_probe *p;
+    int _errno;
+
+    if (!cfg->filename || (cfg->interval < 0) || (cfg->iterations < 0) ||
+        (cfg->blocksize < 0) || (cfg->blocksize > BS_MAX)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((p = calloc(1, sizeof(*p))) == NULL)
+        return NULL;
+    if ((p->filename = strdup(cfg->filename)) == NULL) {
+        free(p);
+        return NULL;
+    }
+    p->interval = cfg->interval;
+    p->iterations = cfg->iterations;
+    p->wcfg.filename = p->filename;
+    p->wcfg.blocksize = cfg->blocksize;
+    p->wcfg.durability = cfg->durability == TW_DURABILITY_NONE ? DURABILITY_NONE : DURABILITY_OSYNC;
+    p->wcfg.lock_mode = cfg->lock ? LOCKMODE_HELD : LOCKMODE_NONE;
+    p->wcfg.excl_lock = cfg->lock;
+    p->wcfg.payload = PAYLOAD_BUF;
+    p->wcfg.engine = ENGINE_WRITE;
+    p->wcfg.quiet = 1;
+    // failmax 0: a library must never exit() its host
+    p->wcfg.failmax = 0;
+
+    if (line_setup(&p->st, &p->wcfg)) {
+        _errno = errno ? errno : EIO;
+        line_setup_undo(&p->st);
+        free(p->filename);
+        free(p);
+        errno = _errno;
+        return NULL;
+    }
+    if ((p->st.wake_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1) {
+        _errno = errno;
+        line_setup_undo(&p->st);
+        free(p->filename);
+        free(p);
+        errno = _errno;
+        return NULL;
+    }
+    p->st.interval = p->interval;
+    p->st.pause = p->interval;
+    p->st.per_second = 0;
+    p->st.on_write = probe_on_write;
+    p->st.on_write_arg = p;
+    p->loop = line_loop_select(&p->st);
+    pthread_mutex_init(&p->lock, NULL);
+    hist_init(&p->hist);
+    return p;
+}
+
+
+int tw_probe_run(struct tw_probe *probe, int iterations)
+{
+    if (probe->running) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (iterations <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    // sequence numbers carry on from earlier runs
+    probe->wcfg.iterations = probe->st.next_iter + iterations;
+    atomic_store(&probe->st.stop, 0);
+    return probe->loop(&probe->st) ? -1 : 0;
+}
+
+
+int tw_probe_start(struct tw_probe *probe)
+{
+    uint64_t drain;
+    int rc;
+
+    if (probe->running) {
+        errno = EBUSY;
+        return -1;
+    }
+    probe->wcfg.iterations = probe->iterations ? probe->st.next_iter + probe->iterations : INT_MAX;
+    atomic_store(&probe->st.stop, 0);
+    if (read(probe->st.wake_fd, &drain, sizeof(drain)) == -1) {
+        // nothing left over from an earlier stop
+    }
+    if ((rc = pthread_create(&probe->thread, NULL, probe_main, probe)) != 0) {
+        errno = rc;
+        return -1;
+    }
+    probe->running = 1;
+    return 0;
+}
+
+
+int tw_probe_stop(struct tw_probe *probe)
+{
+    uint64_t one = 1;
+
+    if (!probe->running)
+        return 0;
+    atomic_store(&probe->st.stop, 1);
+    if (write(probe->st.wake_fd, &one, sizeof(one)) == -1) {
+        // already poked, the loop will see stop
+    }
+    pthread_join(probe->thread, NULL);
+    // or the next tw_probe_run() finds it set and never sleeps
+    if (read(probe->st.wake_fd, &one, sizeof(one)) == -1) {
+        // the loop had already consumed it
+    }
+    probe->running = 0;
+    return 0;
+}
+
+
+void tw_probe_snapshot(struct tw_probe *probe, struct tw_stats *stats)
+{
+    struct lat_hist h;
+
+    pthread_mutex_lock(&probe->lock);
+    h = probe->hist;
+    stats->failures = probe->failures;
+    stats->bytes = probe->bytes;
+    stats->last_errno = probe->last_errno;
+    pthread_mutex_unlock(&probe->lock);
+
+    stats->writes = h.count;
+    stats->min = h.count ? h.min : 0;
+    stats->avg = h.count ? h.sum / h.count : 0;
+    stats->p50 = hist_percentile(&h, 50);
+    stats->p90 = hist_percentile(&h, 90);
+    stats->p99 = hist_percentile(&h, 99);
+    stats->max = h.max;
+}
+
+
+void tw_probe_reset(struct tw_probe *probe)
+{
+    pthread_mutex_lock(&probe->lock);
+    hist_init(&probe->hist);
+    probe->failures = 0;
+    probe->bytes = 0;
+    probe->last_errno = 0;
+    pthread_mutex_unlock(&probe->lock);
+}
+
+
+void tw_probe_destroy(struct tw_probe *probe)
+{
+    tw_probe_stop(probe);
+    close(probe->st.wake_fd);
+    close(probe->st.fd);
+    free(probe->st.write_buf);
+    pthread_mutex_destroy(&probe->lock);
+    free(probe->filename);
+    free(probe);
+}
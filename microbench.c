@@ -0,0 +1,241 @@
+/*
+    microbench : ns/op of timed-writer's own hot paths
+
+    Copyright (C) 2022 Brendon Caligari <caligari@cypraea.co.uk>
+
+    License: GNU Affero General Public License
+        https://www.gnu.org/licenses/agpl-3.0.en.html
+
+    Built from the same source as the tool, so it times the code that
+    ships: timer reads, histogram updates, payload generation, CRC32C,
+    the daemon's target ring and the formatting done per iteration.  Any
+    of these getting slower inflates every latency the tool reports.
+*/
+
+#include "libtimedwriter.c"
+
+#define MICROBENCH_REPS     5
+#define MICROBENCH_MIN_TIME 0.1         /* seconds per repetition */
+#define MICROBENCH_SAMPLES  4096        /* pre-generated latencies, power of 2 */
+
+static volatile uint64_t sink;
+static double samples[MICROBENCH_SAMPLES];
+static struct lat_hist bench_hist;
+static struct ptr_ring bench_ring;
+static unsigned char *bench_buf;
+static char line_buf[BS_DEF];
+static FILE *devnull;
+
+
+void usage_microbench(char *progname)
+{
+    printf("Usage: %s [-r REPS] [NAME]\n", progname);
+    printf("       %s -h\n", progname);
+    printf("\n");
+    printf("Times each internal component and prints min and median ns/op\n");
+    printf("\n");
+    printf("        -r REPS       : repetitions of at least %.1lf s each (def: %d)\n",
+        MICROBENCH_MIN_TIME,
+        MICROBENCH_REPS);
+    printf("        NAME          : only run components whose name contains NAME\n");
+    printf("        -h            : this message\n");
+    printf("\n");
+}
+
+
+static void bench_now_mono(unsigned long i)
+{
+    sink += (uint64_t) now_mono() + i;
+}
+
+static void bench_now_real(unsigned long i)
+{
+    sink += (uint64_t) now_real() + i;
+}
+
+static void bench_hist_record(unsigned long i)
+{
+    hist_record(&bench_hist, samples[i & (MICROBENCH_SAMPLES - 1)]);
+}
+
+static void bench_hist_percentile(unsigned long i)
+{
+    sink += (uint64_t) (hist_percentile(&bench_hist, 99) * 1000000) + i;
+}
+
+static void bench_payload_header(unsigned long i)
+{
+    sink += payload_header(bench_buf, (int) i, 0);
+}
+
+static void bench_fill_4k(unsigned long i)
+{
+    payload_fill_scalar(bench_buf, 4096, (int) i);
+}
+
+static void bench_fill_nt_4k(unsigned long i)
+{
+    payload_fill_nt(bench_buf, 4096, (int) i);
+}
+
+static void bench_fill_1m(unsigned long i)
+{
+    payload_fill_scalar(bench_buf, 1024 * 1024, (int) i);
+}
+
+static void bench_fill_nt_1m(unsigned long i)
+{
+    payload_fill_nt(bench_buf, 1024 * 1024, (int) i);
+}
+
+static void bench_crc32c_64(unsigned long i)
+{
+    sink += crc32c((uint32_t) i, bench_buf, 64);
+}
+
+static void bench_crc32c_4k(unsigned long i)
+{
+    sink += crc32c((uint32_t) i, bench_buf, 4096);
+}
+
+static void bench_ptr_ring(unsigned long i)
+{
+    ptr_ring_push(&bench_ring, (void *) i);
+    sink += (uint64_t) ptr_ring_pop(&bench_ring);
+}
+
+static void bench_format_line(unsigned long i)
+{
+    sink += (uint64_t) snprintf(line_buf, sizeof(line_buf),
+        "write() took approx %.2lf seconds (user: %.2lf; sys: %.2lf)\n",
+        samples[i & (MICROBENCH_SAMPLES - 1)],
+        0.01,
+        0.02);
+}
+
+static void bench_format_real(unsigned long i)
+{
+    format_real(line_buf, sizeof(line_buf), 1700000000.0 + (double) i);
+}
+
+static void bench_flight_csv(unsigned long i)
+{
+    struct flight_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.when = 1700000000.0 + (double) i;
+    rec.seq = (int) i;
+    rec.latency = samples[i & (MICROBENCH_SAMPLES - 1)];
+    flight_write(devnull, &rec);
+}
+
+
+static const struct {
+    const char *name;
+    void (*op)(unsigned long i);
+} benches[] = {
+    { "now_mono", bench_now_mono },
+    { "now_real", bench_now_real },
+    { "hist_record", bench_hist_record },
+    { "hist_percentile", bench_hist_percentile },
+    { "payload_header", bench_payload_header },
+    { "payload_fill 4k", bench_fill_4k },
+    { "payload_fill_nt 4k", bench_fill_nt_4k },
+    { "payload_fill 1m", bench_fill_1m },
+    { "payload_fill_nt 1m", bench_fill_nt_1m },
+    { "crc32c 64", bench_crc32c_64 },
+    { "crc32c 4k", bench_crc32c_4k },
+    { "ptr_ring push+pop", bench_ptr_ring },
+    { "format line", bench_format_line },
+    { "format_real", bench_format_real },
+    { "flight csv", bench_flight_csv },
+};
+
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* grow the batch until it takes MICROBENCH_MIN_TIME, then time REPS batches */
+static void run_bench(const char *name, void (*op)(unsigned long), int reps)
+{
+    double ns[reps], t;
+    unsigned long n = 1;
+
+    for (;;) {
+        t = now_mono();
+        for (unsigned long i = 0; i < n; i++)
+            op(i);
+        if (now_mono() - t >= MICROBENCH_MIN_TIME / 10)
+            break;
+        n *= 2;
+    }
+    n *= 10;
+    for (int r = 0; r < reps; r++) {
+        t = now_mono();
+        for (unsigned long i = 0; i < n; i++)
+            op(i);
+        ns[r] = (now_mono() - t) / n * 1000000000;
+    }
+    qsort(ns, (size_t) reps, sizeof(double), compare_double);
+    printf("%-22s %12.1lf %12.1lf %12lu\n", name, ns[0], ns[reps / 2], n);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *filter = NULL;
+    long reps = MICROBENCH_REPS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:h")) != -1) {
+        switch(opt) {
+        case 'h':
+            usage_microbench(argv[0]);
+            exit(EXIT_SUCCESS);
+            break;
+        case 'r':
+            reps = atol(optarg);
+            if ((reps < 1) || (reps > 100)) {
+                fprintf(stderr, "Invalid repetitions: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, "Command line gibberish, try -h\n");
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+    if (optind < argc)
+        filter = argv[optind];
+
+    // log-uniform latencies from 10 us to 10 s, the range a run actually sees
+    srand(1);
+    for (int i = 0; i < MICROBENCH_SAMPLES; i++)
+        samples[i] = 0.00001 * pow(10, 6.0 * rand() / RAND_MAX);
+    hist_init(&bench_hist);
+    for (int i = 0; i < MICROBENCH_SAMPLES; i++)
+        hist_record(&bench_hist, samples[i]);
+    if ((bench_buf = aligned_alloc(4096, 1024 * 1024)) == NULL ||
+        (ptr_ring_init(&bench_ring, 64) == -1) ||
+        ((devnull = fopen("/dev/null", "w")) == NULL)) {
+        fprintf(stderr, "Unable to set up benchmarks: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memset(bench_buf, '\r', 1024 * 1024);
+
+    printf("%-22s %12s %12s %12s\n", "component", "min ns/op", "p50 ns/op", "ops/rep");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+        if (!filter || strstr(benches[i].name, filter))
+            run_bench(benches[i].name, benches[i].op, (int) reps);
+
+    fclose(devnull);
+    ptr_ring_free(&bench_ring);
+    free(bench_buf);
+    return 0;
+}
@@ -6,162 +6,431 @@
     License: GNU Affero General Public License
         https://www.gnu.org/licenses/agpl-3.0.en.html
 
+    The command line; everything it runs lives in libtimedwriter.c.
+
     TODO:
         - signal handling for controlled termination
         - cleanup code because this is embarrassing
 */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <errno.h>
-#include <string.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <sys/time.h>
-#include <sys/file.h>
-#include <sys/times.h>
-#include <limits.h>
-#include <time.h>
-#include <getopt.h>
-
-#define INTERVAL_DEFAULT    5
-#define INTERVAL_MIN        1
-#define INTERVAL_MAX        60*60
-#define ITERATION_MAX       666
-#define FAILURE_MAX         100
-#define FAILURE_DEFAULT     5
-#define BS_DEF              1024
-#define BS_MAX              1024 * 1024 * 32
+#include "timedwriter-internal.h"
 
 
 void usage(char *progname)
 {
-    printf("Usage: %s [-s SLEEP ] [-c MAX_ITER] [-f MAX_FAIL] [-b BLOCK_SIZE] [-l] FILENAME\n", progname);
+    printf("Usage: %s [-s SLEEP ] [-c MAX_ITER] [-f MAX_FAIL] [-b BLOCK_SIZE] [-l|-L] [-q] [-w WORKLOAD] [-n WRITERS] [-j CHUNKS] [-d DURABILITY [-F FLUSH_MS] [-W WINDOW]] [-p PAYLOAD] [-M NAME] [-R SECONDS [-A SECONDS]] [-T THRESHOLD_MS [-B BURST_MS]] [-C SOCKET] [-k SECONDS] [-r] [-t TRACE] [-D] [-e] [-E ENGINE[:ARGS]] [-O LOWER:UPPER:WORK] FILENAME\n", progname);
+    printf("       %s monitor [-s SECONDS] [-c COUNT] NAME\n", progname);
+    printf("       %s loopbench [-c ITERATIONS]\n", progname);
+    printf("       %s compare [-c PAIRS] [-s SLEEP] [-o ORDER] [-q] TARGET_A TARGET_B\n", progname);
+    printf("       %s report [-o OUTPUT] [-w SECONDS] TRACE\n", progname);
+    printf("       %s daemon [-c MAX_ITER] [-t THREADS] [-m METRICS_FILE [-e SECONDS]] CONFIG\n", progname);
     printf("       %s -h\n", progname);
     printf("\n");
     printf("Writes a line to FILENAME with SLEEP seconds between writes\n");
     printf("\n");
-    printf("        -s SLEEP      : seconds sleep after each iteration (default: %d; bounds: [%d, %d])\n",
+    printf("        -s SLEEP      : seconds sleep after each iteration (default: %d; bounds: [%d, %d]; 0: no sleep)\n",
         INTERVAL_DEFAULT,
         INTERVAL_MIN,
         INTERVAL_MAX);
-    printf("        -c MAX_ITER   : limit iterations to MAX_ITER (def: %d)\n",
+    printf("        -c MAX_ITER   : limit iterations to MAX_ITER <= %d, <= %d with -w cores (def: %d)\n",
+        ITERATION_MAX,
+        CORES_ITERATION_MAX,
         ITERATION_MAX);
     printf("        -f MAX_FAIL   : limit consecutive write() failures to MAX_FAIL <= %d (def: %d; inf: 0)\n",
         FAILURE_MAX,
         FAILURE_DEFAULT);
-    printf("        -b BLOCK_SIZE : set write() size to BLOCK_SIZE <= %d (def: 0)\n", BS_MAX);
+    printf("        -b BLOCK_SIZE : set write() size to BLOCK_SIZE <= %d, <= %d with -p iov (def: 0)\n",
+        BS_MAX,
+        BS_MAX_IOV);
     printf("                        0 writes iteration's \"%%d\\n\"\n");
     printf("        -l            : place LOCK_EX on FILENAME\n");
+    printf("        -L            : -w line takes LOCK_EX around each write() and reports the wait\n");
+    printf("        -q            : -w line doesn't print each iteration\n");
+    printf("        -w WORKLOAD   : line (def), publish, append, cores, copyup or automount\n");
+    printf("                        line    : write() to FILENAME\n");
+    printf("                        publish : per iteration, publish a blob as FILENAME.tmpfile.N via\n");
+    printf("                                  O_TMPFILE + linkat() and as FILENAME.rename.N via a\n");
+    printf("                                  temp file + rename(), timing each step of both\n");
+    printf("                        append  : 1, 2, 4 ... WRITERS processes append CRC framed records\n");
+    printf("                                  to FILENAME with O_APPEND (under LOCK_EX with -l), then\n");
+    printf("                                  verify for torn, interleaved and lost records\n");
+    printf("                        cores   : a thread pinned to each usable CPU writes MAX_ITER blocks\n");
+    printf("                                  to its own FILENAME.CPU through its own io_uring, %d\n",
+        CORES_DEPTH);
+    printf("                                  in flight with -s 0 (pwrite() if io_uring is unavailable);\n");
+    printf("                                  reports per-core IOPS and how far apart the cores are;\n");
+    printf("                                  MAX_ITER is per core, the default %d is a burst that\n",
+        ITERATION_MAX);
+    printf("                                  ramp-up still weighs on; raise it for a sustained rate;\n");
+    printf("                                  elapsed time and IOPS leave -s sleeps out\n");
+    printf("                        copyup  : FILENAME is where the -O overlay is mounted; files of %d KiB\n",
+        COPYUP_SIZE_MIN / 1024);
+    printf("                                  to %d MiB are staged uncached in its lower layer, then\n",
+        COPYUP_SIZE_MAX / (1024 * 1024));
+    printf("                                  1, 2, 4 ... WRITERS threads at once time the copy-up\n");
+    printf("                                  open(), the first write and MAX_ITER steady writes each\n");
+    printf("                        automount : FILENAME is under an automount point; each iteration\n");
+    printf("                                  times stat(), open() and write() of a fresh access,\n");
+    printf("                                  split cold (the access mounted something) and warm.\n");
+    printf("                                  The mount is expired first with umount2(MNT_EXPIRE)\n");
+    printf("                                  when autofs manages it and that's permitted, otherwise\n");
+    printf("                                  set SLEEP above the autofs timeout\n");
+    printf("        -n WRITERS    : writer processes for -w append, threads for -w copyup <= %d (def: %d)\n",
+        WRITERS_MAX,
+        WRITERS_DEFAULT);
+    printf("        -j CHUNKS     : -w line also writes each block as CHUNKS <= %d page aligned pwrite()s\n", CHUNKS_MAX);
+    printf("                        from parallel threads and compares with a single pwrite() (def: 1)\n");
+    printf("        -d DURABILITY : -w line durability, osync (def), none, deferred or writebehind\n");
+    printf("                        (-w cores: osync or none)\n");
+    printf("                        osync    : FILENAME is opened with O_SYNC\n");
+    printf("                        none     : buffered write()s, never fsync()ed\n");
+    printf("                        deferred : buffered write()s, a background thread fsync()s every\n");
+    printf("                                   FLUSH_MS and reports the durability lag of each write\n");
+    printf("                        writebehind : buffered write()s, each completed WINDOW is started with\n");
+    printf("                                   sync_file_range(), the one before it is waited on and\n");
+    printf("                                   dropped from the page cache with POSIX_FADV_DONTNEED\n");
+    printf("        -F FLUSH_MS   : milliseconds between deferred fsync()s <= %d (def: %d)\n",
+        FLUSH_MS_MAX,
+        FLUSH_MS_DEFAULT);
+    printf("        -W WINDOW     : write-behind window bytes, [%d, %d] (def: %d)\n",
+        WINDOW_MIN,
+        WINDOW_MAX,
+        WINDOW_DEFAULT);
+    printf("        -p PAYLOAD    : -w line payload, buf (def), iov, regen or regen-nt\n");
+    printf("                        buf : one BLOCK_SIZE buffer per writer\n");
+    printf("                        iov : writev() of a %d byte header segment followed by one\n", IOV_SEGMENT);
+    printf("                              shared %d byte segment repeated, not with -j\n", IOV_SEGMENT);
+    printf("                        regen    : the whole buffer is regenerated every iteration\n");
+    printf("                        regen-nt : as regen, with non-temporal (streaming) stores\n");
+    printf("                        regen modes report fill time and LLC misses of fill and write()\n");
+    printf("        -M NAME       : publish -w line live counters and latency histogram in the POSIX\n");
+    printf("                        shared memory object /timed-writer.NAME for the monitor subcommand;\n");
+    printf("                        refused while another running writer holds NAME\n");
+    printf("        -R SECONDS    : -w line flight recorder, keep detailed records of the last SECONDS\n");
+    printf("                        <= %d and dump them to timed-writer.flight.PID.N.csv when a write is\n",
+        FLIGHT_WINDOW_MAX);
+    printf("                        a %d sigma latency outlier or %d writes fail in a row; the ring\n",
+        FLIGHT_SIGMAS,
+        FLIGHT_FAIL_STREAK);
+    printf("                        holds %d records, dumps say when that is less than SECONDS\n",
+        FLIGHT_RING);
+    printf("        -A SECONDS    : keep recording into the dump for SECONDS after a trigger (def: %d)\n",
+        FLIGHT_AFTER_DEFAULT);
+    printf("        -T THRESHOLD_MS : -w line adaptive sampling, a write slower than THRESHOLD_MS or a\n");
+    printf("                        failure starts a brownout sampled every BURST_MS until %d writes in\n",
+        ADAPT_RECOVER);
+    printf("                        a row are fast; burst writes count towards MAX_ITER\n");
+    printf("        -B BURST_MS   : milliseconds between writes during a brownout (def: %d)\n",
+        ADAPT_BURST_DEFAULT);
+    printf("        -C SOCKET     : -w line control socket; one command per line, applied between writes:\n");
+    printf("                        set-rate WRITES_PER_SECOND|max, set-bs BYTES, set-lock none|held|write,\n");
+    printf("                        pause, resume, snapshot, reset-window, add-writers [N] and\n");
+    printf("                        remove-writers [N] (extra threads appending to FILENAME; the main\n");
+    printf("                        writer appends too while any run; not with -j or -E), help, quit\n");
+    printf("        -k SECONDS    : -w line checkpoints sequence, offset and histograms to\n");
+    printf("                        FILENAME.checkpoint every SECONDS and when done\n");
+    printf("        -r            : -w line resumes from FILENAME.checkpoint: FILENAME is not truncated,\n");
+    printf("                        numbering carries on towards MAX_ITER and stats are merged\n");
+    printf("                        (checkpoints every %d s unless -k)\n", CHECKPOINT_DEFAULT);
+    printf("        -t TRACE      : -w line writes time, seq, errno, bytes and latency of every write\n");
+    printf("                        to CSV file TRACE (appended to with -r)\n");
+    printf("        -D            : -w line full-screen terminal dashboard refreshed %d times a second:\n",
+        DASHBOARD_HZ);
+    printf("                        IOPS, MB/s, p50/p99/max over the last %d s, failure streak, lock\n",
+        DASHBOARD_WINDOW);
+    printf("                        wait and a p99 sparkline; implies -q\n");
+    printf("        -e            : -w line samples RAPL package and core energy from %s around\n",
+        RAPL_ROOT);
+    printf("                        each write, per -C window and for the run: joules, watts, J/GiB\n");
+    printf("                        and J/op next to user and sys CPU time (energy_uj is root only)\n");
+    printf("        -E ENGINE     : -w line writes through an engine instead of write(): the built-in\n");
+    printf("                        write, or the path of a plugin shared object (ABI %d, see\n",
+        TW_ENGINE_ABI_VERSION);
+    printf("                        timedwriter.h); ARGS are passed to its open().  Not with -l, -L,\n");
+    printf("                        -j, -p iov, -d deferred|writebehind or -r\n");
+    printf("        -O LOWER:UPPER:WORK : -w copyup mounts an overlay of these on FILENAME while each\n");
+    printf("                        phase runs; required, and LOWER must be scratch space that\n");
+    printf("                        no other overlay uses, as files are staged in it\n");
+    printf("\n");
+    printf("monitor attaches to the live metrics of instance NAME and prints them every SECONDS\n");
+    printf("(def: 1) for COUNT samples (def: 0, until interrupted), or until it finds the writer gone\n");
+    printf("\n");
+    printf("loopbench times the line loop without I/O, specialised and generic, for growing sets\n");
+    printf("of modes (def: %d iterations)\n", LOOPBENCH_ITERATIONS);
+    printf("\n");
+    printf("compare writes the same blocks to TARGET_A and TARGET_B, each a daemon CONFIG line,\n");
+    printf("in PAIRS (def: %d) pairs SLEEP seconds apart (def: the targets' shared INTERVAL);\n",
+        COMPARE_PAIRS_DEFAULT);
+    printf("ORDER is alternate (def), A first on even pairs, or random.  Reports paired\n");
+    printf("differences, a Wilcoxon signed-rank test and which target is faster at p < %.2lf\n",
+        COMPARE_ALPHA);
+    printf("\n");
+    printf("report renders TRACE, a -t trace or a -R flight recorder dump, as one self-contained\n");
+    printf("HTML file OUTPUT (def: TRACE.html): a latency heatmap over time on the histogram's\n");
+    printf("log buckets, latency CDFs for the run and each quarter of it, and throughput with\n");
+    printf("failed writes per SECONDS window (def: the run split into about %d windows)\n",
+        REPORT_COLUMNS);
+    printf("\n");
+    printf("daemon probes every target in CONFIG from one process until interrupted, or for\n");
+    printf("MAX_ITER writes per target, one target per line:\n");
+    printf("        PATH INTERVAL BLOCK_SIZE lock|nolock osync|none\n");
+    printf("Due probes run on THREADS worker threads <= %d (def: %d).  Consecutive failures back\n",
+        DAEMON_THREADS_MAX,
+        DAEMON_THREADS_DEFAULT);
+    printf("off exponentially; lock takes LOCK_EX without waiting.  Per-target metrics are\n");
+    printf("written in Prometheus text format to METRICS_FILE every SECONDS (def: %d).  Probes are\n",
+        DAEMON_EXPORT_DEFAULT);
+    printf("scheduled on a %d us tick timing wheel; its overhead and deadline lateness are reported\n",
+        WHEEL_TICK_NS / 1000);
+    printf("on exit.  Once interrupted, probes get %d s to finish; those still hung are reported\n",
+        DAEMON_GRACE);
+    printf("and left behind, and the daemon exits with failure\n");
     printf("\n");
     printf("Example: %s /mnt/myfile.txt\n", progname);
     printf("         %s -s 5 -c 100 -l /mnt/myexlusive.txt\n", progname);
     printf("         %s -s 1 -c 10 -f 2 -b $((1024*1024)) -l /mnt/megwrite.txt\n", progname);
+    printf("         %s -s 1 -c 50 -b 65536 -w publish /mnt/blobs/blob\n", progname);
+    printf("         %s -s 0 -c 500 -b 4096 -n 16 -w append /mnt/shared.log\n", progname);
+    printf("         %s -s 0 -c 666 -b 4096 -d none -w cores /mnt/nvme/iops\n", progname);
+    printf("         %s -c 20 -b 4096 -n 8 -w copyup -O /scratch/lower:/scratch/upper:/scratch/work /mnt/merged\n",
+        progname);
+    printf("         %s -s 60 -w automount /net/filer/export/probe\n", progname);
+    printf("         %s -s 1 -c 100 -b 65536 -E ./objstore-engine.so:bucket=probes probe-object\n", progname);
+    printf("         %s -s 1 -c 20 -b $((32*1024*1024)) -j 8 /mnt/backup.img\n", progname);
+    printf("         %s -s 0 -c 600 -b 4096 -d deferred -F 250 /mnt/journal\n", progname);
+    printf("         %s -s 5 -c 100 -b $((256*1024*1024)) -p iov /mnt/hugewrite\n", progname);
+    printf("         %s -s 0 -c 200 -b $((16*1024*1024)) -p regen-nt -d none /mnt/fresh\n", progname);
+    printf("         %s -s 1 -M canary /mnt/canary & %s monitor -s 5 canary\n", progname, progname);
+    printf("         %s -s 1 -c 666 -L -D /mnt/shared\n", progname);
+    printf("         %s -s 0 -c 666 -b $((4*1024*1024)) -d writebehind -W $((16*1024*1024)) /mnt/stream\n", progname);
+    printf("         %s -s 0 -c 666 -b $((1024*1024)) -q -e /mnt/nvme\n", progname);
+    printf("         %s -s 1 -c 666 -R 120 -A 30 /mnt/canary\n", progname);
+    printf("         %s -s 60 -c 666 -T 500 -B 250 /mnt/canary\n", progname);
+    printf("         %s compare -s 1 -c 300 '/mnt/a/probe 1 4096 nolock osync' '/mnt/b/probe 1 4096 nolock osync'\n",
+        progname);
+    printf("         %s -s 0 -c 666 -q -t /tmp/trace.csv /mnt/canary && %s report /tmp/trace.csv\n",
+        progname, progname);
+    printf("         %s daemon -m /run/timed-writer.prom /etc/timed-writer.conf\n", progname);
     printf("\n");
 }
 
 
-int line_writer(const char *filename,
-                int interval,
-                int excl_lock,
-                int iterations,
-                int failmax,
-                int blocksize)
+int monitor_main(char *progname, int argc, char *argv[])
 {
-    char str_buf[BS_DEF];
-    void *write_buf;
-    size_t write_buf_size;
-    size_t str_len, write_actual;
-    ssize_t ws;
-    int _errno;
-    int fd;
-    int failures = 0;
-    struct timeval wall_clock_before;
-    struct timeval wall_clock_after;
-    double wall_clock_delta;
-    struct tms times_before;
-    struct tms times_after;
-    double user_times_delta;
-    double sys_times_delta;
-
-    write_buf_size = blocksize > BS_DEF ? (size_t) blocksize : (size_t) BS_DEF;
-
-    printf("Filename: %s\n", filename);
-    printf("Exclusive lock: %s\n", excl_lock ? "on" : "off");
-    printf("Sleep after each write: %u\n", interval);
-    printf("Max iterations: %u\n", iterations);
-    printf("Max consecutive write fails: %u\n", failmax);
-    printf("Write size: %u\n", blocksize);
-
-    write_buf = malloc(write_buf_size);
-    memset(write_buf, '\r', write_buf_size);
-
-    if ((fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC|O_SYNC, (mode_t) 0666)) == -1) {
-        _errno = errno;
-        fprintf(stderr, "Unable to open %s : open() returned %d (%s)\n",
-            filename,
-            _errno,
-            strerror(_errno));
-        return 1;
-    }
-
-    if (excl_lock) {
-        if (flock(fd, LOCK_EX) == -1) {
-            _errno = errno;
-            fprintf(stderr, "Unable to place lock on %s : flock() returned %d (%s)\n",
-                filename,
-                _errno,
-                strerror(_errno));
-            return 1;
+    long interval = 1;
+    long count = 0;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "s:c:h")) != -1) {
+        switch(opt) {
+        case 'h':
+            usage(progname);
+            exit(EXIT_SUCCESS);
+            break;
+        case 's':
+            interval = atol(optarg);
+            if ((interval < 1) || (interval > (long) INTERVAL_MAX)) {
+                fprintf(stderr, "Invalid monitor interval: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'c':
+            count = atol(optarg);
+            if (count < 0) {
+                fprintf(stderr, "Invalid monitor count: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, "Command line gibberish, try -h\n");
+            exit(EXIT_FAILURE);
+            break;
         }
     }
-    
-    for (int iter = 0; iter < iterations;) {
-        sprintf(str_buf, "%d\n", iter);
-        strcpy((char *) write_buf, str_buf);
-        str_len = strlen(str_buf);
-        write_actual = blocksize ? (size_t) blocksize : str_len;
-        printf("\nWriting sequence %d (%d bytes)\n", iter, write_actual);
-        gettimeofday(&wall_clock_before, NULL);
-        times(&times_before);
-        ws = write(fd, write_buf, write_actual);
-        _errno = errno;
-        times(&times_after);
-        gettimeofday(&wall_clock_after, NULL);
-        if (ws == -1) {
-            fprintf(stderr, "write() failed with errno %d (%s)\n",
-                _errno,
-                strerror(_errno));
-            if (failmax > 0) {
-                failures++;
-                if (failures == failmax) {
-                    fprintf(stderr, "Reached max failcount ... bye!\n");
-                    exit(EXIT_FAILURE);
-                }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "Expecting one, and only one, instance NAME\n");
+        exit(EXIT_FAILURE);
+    }
+    return live_monitor(argv[optind], (int) interval, (int) count);
+}
+
+
+int loopbench_main(char *progname, int argc, char *argv[])
+{
+    long iterations = LOOPBENCH_ITERATIONS;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "c:h")) != -1) {
+        switch(opt) {
+        case 'h':
+            usage(progname);
+            exit(EXIT_SUCCESS);
+            break;
+        case 'c':
+            iterations = atol(optarg);
+            if ((iterations <= 0) || (iterations > (long) INT_MAX)) {
+                fprintf(stderr, "Invalid iterations: %s\n", optarg);
+                exit(EXIT_FAILURE);
             }
-        } else
-            failures = 0;
-        if ((ws != -1) && (ws != (ssize_t) write_actual))
-            printf("write() returned %d instead of %d. Interrupted?!!\n", (int) ws, (int) write_actual);
-        wall_clock_delta = 
-            ((double) wall_clock_after.tv_sec + ((double) wall_clock_after.tv_usec / 1000000)) -
-            ((double) wall_clock_before.tv_sec + ((double) wall_clock_before.tv_usec / 1000000));
-        user_times_delta =
-            ((double) (times_after.tms_utime - times_before.tms_utime) / sysconf(_SC_CLK_TCK));
-        sys_times_delta =
-            ((double) (times_after.tms_stime - times_before.tms_stime) / sysconf(_SC_CLK_TCK));
-        printf("write() took approx %.2lf seconds (user: %.2lf; sys: %.2lf)\n",
-            wall_clock_delta,
-            user_times_delta,
-            sys_times_delta);
-        if (++iter < iterations)
-            sleep(interval);
-    }
-
-    close(fd);
-    free(write_buf);
+            break;
+        default:
+            fprintf(stderr, "Command line gibberish, try -h\n");
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+    return loopbench((int) iterations);
+}
 
-    return 0;
+
+int compare_main(char *progname, int argc, char *argv[])
+{
+    long pairs = (long) COMPARE_PAIRS_DEFAULT;
+    long interval = -1;
+    int random = 0;
+    int quiet = 0;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "c:s:o:qh")) != -1) {
+        switch(opt) {
+        case 'h':
+            usage(progname);
+            exit(EXIT_SUCCESS);
+            break;
+        case 'c':
+            pairs = atol(optarg);
+            if ((pairs <= 0) || (pairs > (long) INT_MAX)) {
+                fprintf(stderr, "Invalid number of pairs: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            interval = atol(optarg);
+            if ((interval < (long) INTERVAL_MIN) || (interval > (long) INTERVAL_MAX) ||
+                ((interval == 0) && (strcmp(optarg, "0") != 0))) {
+                fprintf(stderr, "Invalid sleep interval: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':                   // pair order
+            if (strcmp(optarg, "random") == 0)
+                random = 1;
+            else if (strcmp(optarg, "alternate") != 0) {
+                fprintf(stderr, "Invalid order: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            fprintf(stderr, "Command line gibberish, try -h\n");
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+    if (optind + 2 != argc) {
+        fprintf(stderr, "Expecting two, and only two, targets\n");
+        exit(EXIT_FAILURE);
+    }
+    return compare_targets(argv[optind], argv[optind + 1], (int) pairs, (int) interval, random, quiet);
+}
+
+
+int report_main(char *progname, int argc, char *argv[])
+{
+    const char *output = NULL;
+    long window = 0;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "o:w:h")) != -1) {
+        switch(opt) {
+        case 'h':
+            usage(progname);
+            exit(EXIT_SUCCESS);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'w':                   // seconds per heatmap column
+            window = atol(optarg);
+            if ((window < 1) || (window > (long) INTERVAL_MAX)) {
+                fprintf(stderr, "Invalid window: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, "Command line gibberish, try -h\n");
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "Expecting one, and only one, TRACE\n");
+        exit(EXIT_FAILURE);
+    }
+    return report_trace(argv[optind], output, (int) window);
+}
+
+
+int daemon_main(char *progname, int argc, char *argv[])
+{
+    const char *metrics_file = NULL;
+    int max_iter = 0;
+    int nworkers = DAEMON_THREADS_DEFAULT;
+    int export_interval = DAEMON_EXPORT_DEFAULT;
+    long v;
+    int opt;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "c:t:m:e:h")) != -1) {
+        switch(opt) {
+        case 'h':
+            usage(progname);
+            exit(EXIT_SUCCESS);
+            break;
+        case 'c':                   // probes per target, 0 = until signalled
+            v = atol(optarg);
+            if ((v < 0) || ((v == 0) && (strcmp(optarg, "0") != 0))) {
+                fprintf(stderr, "Invalid max iterations: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            max_iter = (int) v;
+            break;
+        case 't':                   // worker threads
+            v = atol(optarg);
+            if ((v <= 0) || (v > (long) DAEMON_THREADS_MAX)) {
+                fprintf(stderr, "Invalid number of worker threads: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            nworkers = (int) v;
+            break;
+        case 'm':                   // Prometheus text metrics file
+            metrics_file = optarg;
+            break;
+        case 'e':                   // metrics export interval
+            v = atol(optarg);
+            if ((v <= 0) || (v > (long) INTERVAL_MAX)) {
+                fprintf(stderr, "Invalid export interval: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            export_interval = (int) v;
+            break;
+        default:
+            fprintf(stderr, "Command line gibberish, try -h\n");
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "Expecting one, and only one, CONFIG\n");
+        exit(EXIT_FAILURE);
+    }
+    return daemon_probe(argv[optind], max_iter, nworkers, metrics_file, export_interval);
 }
 
 
@@ -171,10 +440,44 @@ int main(int argc, char *argv[])
     long iterations = (long) ITERATION_MAX;
     long failmax = (long) FAILURE_DEFAULT;
     int excl_lock = 0;
+    enum lock_mode lock_mode = LOCKMODE_NONE;
+    int quiet = 0;
     int blocksize = 0;
+    long writers = (long) WRITERS_DEFAULT;
+    long chunks = 1;
+    long flush_ms = (long) FLUSH_MS_DEFAULT;
+    long window = (long) WINDOW_DEFAULT;
+    enum durability durability = DURABILITY_OSYNC;
+    enum payload payload = PAYLOAD_BUF;
+    enum workload workload = WORKLOAD_LINE;
+    const char *live_name = NULL;
+    const char *control_path = NULL;
+    const char *trace_path = NULL;
+    int dashboard = 0;
+    int energy = 0;
+    const char *engine_spec = NULL;
+    const char *overlay_spec = NULL;
+    long checkpoint_secs = 0;
+    int resume = 0;
+    long flight_window = 0;
+    long flight_after = (long) FLIGHT_AFTER_DEFAULT;
+    long adapt_threshold_ms = 0;
+    long adapt_burst_ms = (long) ADAPT_BURST_DEFAULT;
+    struct writer_config cfg;
     int opt;
 
-    while ((opt = getopt(argc, argv, "s:c:b:f:lh")) != -1) {
+    if ((argc > 1) && (strcmp(argv[1], "monitor") == 0))
+        return monitor_main(argv[0], argc - 1, argv + 1);
+    if ((argc > 1) && (strcmp(argv[1], "loopbench") == 0))
+        return loopbench_main(argv[0], argc - 1, argv + 1);
+    if ((argc > 1) && (strcmp(argv[1], "compare") == 0))
+        return compare_main(argv[0], argc - 1, argv + 1);
+    if ((argc > 1) && (strcmp(argv[1], "report") == 0))
+        return report_main(argv[0], argc - 1, argv + 1);
+    if ((argc > 1) && (strcmp(argv[1], "daemon") == 0))
+        return daemon_main(argv[0], argc - 1, argv + 1);
+
+    while ((opt = getopt(argc, argv, "s:c:b:f:lLqw:n:j:d:F:W:p:M:R:A:T:B:C:k:rt:DeE:O:h")) != -1) {
         switch(opt) {
         case 'h':
             usage(argv[0]);
@@ -182,7 +485,7 @@ int main(int argc, char *argv[])
             break;
         case 's':                   // sleep time between iterations
             interval = atol(optarg);
-            if ((interval == 0) ||
+            if (((interval == 0) && (strcmp(optarg, "0") != 0)) ||
                 (interval > (long) INTERVAL_MAX) ||
                 (interval < (long) INTERVAL_MIN)) {
                     fprintf(stderr, "Invalid sleep time: %s\n", optarg);
@@ -192,7 +495,7 @@ int main(int argc, char *argv[])
         case 'c':                   // maximum iterations
             iterations = atol(optarg);
             if ((iterations <= 0) ||
-                (iterations > (long) ITERATION_MAX)) {
+                (iterations > (long) CORES_ITERATION_MAX)) {
                     fprintf(stderr, "Invalid max iterations: %s\n", optarg);
                     exit(EXIT_FAILURE);
                 }
@@ -208,13 +511,171 @@ int main(int argc, char *argv[])
         case 'b':                   // block size to write, 0 = write iteration string
             blocksize = atol(optarg);
             if ((blocksize < 0) ||
-                (blocksize > (long) BS_MAX)) {
+                (blocksize > (long) BS_MAX_IOV)) {
                     fprintf(stderr, "Invalid write block size: %s\n", optarg);
                     exit(EXIT_FAILURE);
                 }
             break;
         case 'l':
             excl_lock = 1;
+            lock_mode = LOCKMODE_HELD;
+            break;
+        case 'L':                   // lock around each write
+            excl_lock = 1;
+            lock_mode = LOCKMODE_WRITE;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'w':                   // workload
+            if (strcmp(optarg, "line") == 0)
+                workload = WORKLOAD_LINE;
+            else if (strcmp(optarg, "publish") == 0)
+                workload = WORKLOAD_PUBLISH;
+            else if (strcmp(optarg, "append") == 0)
+                workload = WORKLOAD_APPEND;
+            else if (strcmp(optarg, "cores") == 0)
+                workload = WORKLOAD_CORES;
+            else if (strcmp(optarg, "copyup") == 0)
+                workload = WORKLOAD_COPYUP;
+            else if (strcmp(optarg, "automount") == 0)
+                workload = WORKLOAD_AUTOMOUNT;
+            else {
+                fprintf(stderr, "Invalid workload: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':                   // concurrent writers
+            writers = atol(optarg);
+            if ((writers <= 0) ||
+                (writers > (long) WRITERS_MAX)) {
+                    fprintf(stderr, "Invalid number of writers: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+        case 'j':                   // parallel chunks per block
+            chunks = atol(optarg);
+            if ((chunks <= 0) ||
+                (chunks > (long) CHUNKS_MAX)) {
+                    fprintf(stderr, "Invalid number of chunks: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+        case 'd':                   // durability
+            if (strcmp(optarg, "osync") == 0)
+                durability = DURABILITY_OSYNC;
+            else if (strcmp(optarg, "none") == 0)
+                durability = DURABILITY_NONE;
+            else if (strcmp(optarg, "deferred") == 0)
+                durability = DURABILITY_DEFERRED;
+            else if (strcmp(optarg, "writebehind") == 0)
+                durability = DURABILITY_WRITEBEHIND;
+            else {
+                fprintf(stderr, "Invalid durability: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'F':                   // deferred fsync() interval
+            flush_ms = atol(optarg);
+            if ((flush_ms <= 0) ||
+                (flush_ms > (long) FLUSH_MS_MAX)) {
+                    fprintf(stderr, "Invalid flush interval: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+        case 'W':                   // write-behind window
+            window = atol(optarg);
+            if ((window < (long) WINDOW_MIN) ||
+                (window > (long) WINDOW_MAX)) {
+                    fprintf(stderr, "Invalid write-behind window: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+        case 'p':                   // payload construction
+            if (strcmp(optarg, "buf") == 0)
+                payload = PAYLOAD_BUF;
+            else if (strcmp(optarg, "iov") == 0)
+                payload = PAYLOAD_IOV;
+            else if (strcmp(optarg, "regen") == 0)
+                payload = PAYLOAD_REGEN;
+            else if (strcmp(optarg, "regen-nt") == 0)
+                payload = PAYLOAD_REGEN_NT;
+            else {
+                fprintf(stderr, "Invalid payload: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':                   // live metrics instance name
+            if ((optarg[0] == '\0') || strchr(optarg, '/') || (strlen(optarg) > NAME_MAX - 16)) {
+                fprintf(stderr, "Invalid live metrics name: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            live_name = optarg;
+            break;
+        case 'R':                   // flight recorder window
+            flight_window = atol(optarg);
+            if ((flight_window <= 0) ||
+                (flight_window > (long) FLIGHT_WINDOW_MAX)) {
+                    fprintf(stderr, "Invalid flight recorder window: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+        case 'A':                   // flight recorder capture after a trigger
+            flight_after = atol(optarg);
+            if (((flight_after == 0) && (strcmp(optarg, "0") != 0)) ||
+                (flight_after < 0) ||
+                (flight_after > (long) FLIGHT_WINDOW_MAX)) {
+                    fprintf(stderr, "Invalid flight recorder capture time: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+        case 'T':                   // adaptive sampling latency threshold
+            adapt_threshold_ms = atol(optarg);
+            if ((adapt_threshold_ms <= 0) ||
+                (adapt_threshold_ms > (long) ADAPT_THRESHOLD_MAX)) {
+                    fprintf(stderr, "Invalid latency threshold: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+        case 'B':                   // adaptive sampling burst interval
+            adapt_burst_ms = atol(optarg);
+            if ((adapt_burst_ms < (long) ADAPT_BURST_MIN) ||
+                (adapt_burst_ms > (long) INTERVAL_MAX * 1000)) {
+                    fprintf(stderr, "Invalid burst interval: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            break;
+        case 'C':                   // control socket
+            control_path = optarg;
+            break;
+        case 'k':                   // checkpoint interval
+            checkpoint_secs = atol(optarg);
+            if ((checkpoint_secs < 1) || (checkpoint_secs > (long) INTERVAL_MAX)) {
+                fprintf(stderr, "Invalid checkpoint interval: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'r':                   // resume from FILENAME.checkpoint
+            resume = 1;
+            break;
+        case 't':                   // per-write CSV trace
+            trace_path = optarg;
+            break;
+        case 'D':                   // terminal dashboard
+            if (!isatty(STDOUT_FILENO)) {
+                fprintf(stderr, "-D needs a terminal on stdout\n");
+                exit(EXIT_FAILURE);
+            }
+            dashboard = 1;
+            break;
+        case 'e':                   // RAPL energy
+            energy = 1;
+            break;
+        case 'E':                   // I/O engine
+            engine_spec = optarg;
+            break;
+        case 'O':                   // overlay layers to mount
+            overlay_spec = optarg;
             break;
         default:
             fprintf(stderr, "Command line gibberish, try -h\n");
@@ -222,17 +683,88 @@ int main(int argc, char *argv[])
             break;
         }
     }
+    if ((iterations > (long) ITERATION_MAX) && (workload != WORKLOAD_CORES)) {
+        fprintf(stderr, "Iteration counts above %d need -w cores\n", ITERATION_MAX);
+        exit(EXIT_FAILURE);
+    }
+    if ((blocksize > (long) BS_MAX) && (payload != PAYLOAD_IOV)) {
+        fprintf(stderr, "Write block sizes above %d need -p iov\n", BS_MAX);
+        exit(EXIT_FAILURE);
+    }
+    if ((payload == PAYLOAD_IOV) && (chunks > 1)) {
+        fprintf(stderr, "-p iov and -j are mutually exclusive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (engine_spec && ((lock_mode != LOCKMODE_NONE) || (chunks > 1) || (payload == PAYLOAD_IOV) ||
+            (durability == DURABILITY_DEFERRED) || (durability == DURABILITY_WRITEBEHIND) || resume)) {
+        fprintf(stderr, "-E can't be combined with -l, -L, -j, -p iov, -d deferred|writebehind or -r\n");
+        exit(EXIT_FAILURE);
+    }
+    if (((workload == WORKLOAD_CORES) || (workload == WORKLOAD_COPYUP) || (workload == WORKLOAD_AUTOMOUNT)) &&
+        (durability != DURABILITY_OSYNC) && (durability != DURABILITY_NONE)) {
+        fprintf(stderr, "-w cores, copyup and automount support -d osync and none\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((workload == WORKLOAD_COPYUP) != (overlay_spec != NULL)) {
+        fprintf(stderr, "-w copyup needs -O, and -O is only for -w copyup\n");
+        exit(EXIT_FAILURE);
+    }
     if (optind + 1 != argc) {
         fprintf(stderr, "Expecting one, and only one, FILENAME\n");
         exit(EXIT_FAILURE);
     }
 
-    line_writer(argv[optind],
-                (int) interval,
-                excl_lock,
-                (int) iterations,
-                (int) failmax,
-                (int) blocksize);
+    cfg.filename = argv[optind];
+    cfg.interval = (int) interval;
+    cfg.excl_lock = excl_lock;
+    cfg.iterations = (int) iterations;
+    cfg.failmax = (int) failmax;
+    cfg.blocksize = (int) blocksize;
+    cfg.writers = (int) writers;
+    cfg.chunks = (int) chunks;
+    cfg.flush_ms = (int) flush_ms;
+    cfg.window = window;
+    cfg.durability = durability;
+    cfg.payload = payload;
+    cfg.live_name = live_name;
+    cfg.control_path = control_path;
+    cfg.trace_path = trace_path;
+    cfg.dashboard = dashboard;
+    cfg.energy = energy;
+    cfg.engine_spec = engine_spec;
+    cfg.overlay_spec = overlay_spec;
+    cfg.checkpoint_secs = resume && !checkpoint_secs ? CHECKPOINT_DEFAULT : (int) checkpoint_secs;
+    cfg.resume = resume;
+    cfg.flight_window = (int) flight_window;
+    cfg.flight_after = (int) flight_after;
+    cfg.adapt_threshold_ms = (int) adapt_threshold_ms;
+    cfg.adapt_burst_ms = (int) adapt_burst_ms;
+    cfg.quiet = quiet || dashboard;
+    cfg.engine = engine_spec ? ENGINE_PLUGIN : chunks > 1 ? ENGINE_CHUNKED : ENGINE_WRITE;
+    cfg.lock_mode = lock_mode;
+    cfg.workload = workload;
+
+    switch (cfg.workload) {
+    case WORKLOAD_PUBLISH:
+        publish_writer(&cfg);
+        break;
+    case WORKLOAD_APPEND:
+        append_writer(&cfg);
+        break;
+    case WORKLOAD_CORES:
+        cores_writer(&cfg);
+        break;
+    case WORKLOAD_COPYUP:
+        copyup_writer(&cfg);
+        break;
+    case WORKLOAD_AUTOMOUNT:
+        automount_writer(&cfg);
+        break;
+    default:
+        if (line_writer(&cfg))
+            exit(EXIT_FAILURE);
+        break;
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,225 @@
+/*
+    timedwriter-internal.h : shared by the timed-writer CLI, the library
+    and microbench; not installed
+
+    Copyright (C) 2022 Brendon Caligari <caligari@cypraea.co.uk>
+
+    License: GNU Affero General Public License
+        https://www.gnu.org/licenses/agpl-3.0.en.html
+*/
+
+#ifndef TIMEDWRITER_INTERNAL_H
+#define TIMEDWRITER_INTERNAL_H
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/file.h>
+#include <sys/times.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <time.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <sched.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mount.h>
+#include <sys/vfs.h>
+#include <math.h>
+#include <sys/syscall.h>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <linux/io_uring.h>
+#include <linux/magic.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "timedwriter.h"
+
+#define INTERVAL_DEFAULT    5
+#define INTERVAL_MIN        0
+#define INTERVAL_MAX        60*60
+#define ITERATION_MAX       666
+#define FAILURE_MAX         100
+#define FAILURE_DEFAULT     5
+#define BS_DEF              1024
+#define BS_MAX              1024 * 1024 * 32
+#define BS_MAX_IOV          1024 * 1024 * 1024
+#define IOV_SEGMENT         (64 * 1024)
+#define WRITERS_DEFAULT     4
+#define WRITERS_MAX         64
+#define COPYUP_SIZE_MIN     4096
+#define COPYUP_SIZE_MAX     (64 * 1024 * 1024)
+#define WRITE_ENGINE_BATCH  64
+#define CORES_DEPTH         32              /* -w cores writes in flight per ring with -s 0 */
+#define CORES_ITERATION_MAX (1000 * 1000 * 1000)  /* -w cores runs long enough to get past ramp-up */
+#define CHUNKS_MAX          64
+#define FLUSH_MS_DEFAULT    1000
+#define FLUSH_MS_MAX        60*60*1000
+#define WINDOW_DEFAULT      1024 * 1024 * 8
+#define WINDOW_MIN          4096
+#define WINDOW_MAX          1024 * 1024 * 1024
+#define DAEMON_THREADS_DEFAULT  4
+#define DAEMON_THREADS_MAX  64
+#define DAEMON_EXPORT_DEFAULT   10
+#define DAEMON_GRACE        5               /* seconds probes in write() get on shutdown */
+#define WHEEL_TICK_NS       250000          /* 250 us */
+#define WHEEL_BITS          8
+#define WHEEL_SLOTS         (1 << WHEEL_BITS)
+#define WHEEL_LEVELS        4
+#define FLIGHT_RING         4096
+#define FLIGHT_WINDOW_MAX   60*60
+#define FLIGHT_AFTER_DEFAULT    10
+#define FLIGHT_WARMUP       10
+#define FLIGHT_FAIL_STREAK  3
+#define FLIGHT_SIGMAS       4
+#define FLIGHT_ALPHA        0.1
+#define ADAPT_THRESHOLD_MAX 60*60*1000
+#define ADAPT_BURST_DEFAULT 100
+#define ADAPT_BURST_MIN     1
+#define ADAPT_RECOVER       5
+#define LOOPBENCH_ITERATIONS    1000000
+#define COMPARE_PAIRS_DEFAULT   100
+#define COMPARE_MIN_PAIRS   20
+#define COMPARE_ALPHA       0.05
+#define CHECKPOINT_DEFAULT  60
+#define CHECKPOINT_VERSION  1
+#define CONTROL_LINE_MAX    256
+#define CONTROL_REPLY_MAX   2048
+#define CONTROL_LOCK_POLL_MS 1              /* extra writers retry a contended LOCK_EX this often */
+#define HIST_LINE_MAX       160
+#define DASHBOARD_HZ        4               /* refreshes per second */
+#define DASHBOARD_WINDOW    10              /* seconds behind the rolling percentiles */
+#define DASHBOARD_SPARK     60              /* sparkline refreshes */
+#define DASHBOARD_FRAME_MAX 2048
+#define NOTICE_MAX          160
+#define REPORT_WIDTH        800
+#define REPORT_HEIGHT       320
+#define REPORT_MARGIN       50
+#define REPORT_COLUMNS      120             /* time columns when -w is not given */
+#define REPORT_COLUMNS_MAX  2000
+#define REPORT_CDF_POINTS   400
+#define RAPL_ROOT           "/sys/class/powercap"
+#define RAPL_DOMAINS_MAX    16
+#define LIVE_MAGIC          0x564c5754      /* "TWLV" little-endian */
+#define LIVE_VERSION        2
+#define HIST_SUB_BITS       2
+#define HIST_BUCKETS        (40 << HIST_SUB_BITS)
+
+enum workload {
+    WORKLOAD_LINE = 0,
+    WORKLOAD_PUBLISH,
+    WORKLOAD_APPEND,
+    WORKLOAD_CORES,
+    WORKLOAD_COPYUP,
+    WORKLOAD_AUTOMOUNT
+};
+
+enum durability {
+    DURABILITY_OSYNC = 0,
+    DURABILITY_NONE,
+    DURABILITY_DEFERRED,
+    DURABILITY_WRITEBEHIND,
+    DURABILITIES
+};
+
+enum payload {
+    PAYLOAD_BUF = 0,
+    PAYLOAD_IOV,
+    PAYLOAD_REGEN,
+    PAYLOAD_REGEN_NT,
+    PAYLOADS
+};
+
+enum engine {
+    ENGINE_WRITE = 0,
+    ENGINE_CHUNKED,                         /* -j */
+    ENGINE_NULL,                            /* no I/O, loopbench only */
+    ENGINE_PLUGIN,                          /* -E */
+    ENGINES
+};
+
+enum lock_mode {
+    LOCKMODE_NONE = 0,
+    LOCKMODE_HELD,                          /* -l, LOCK_EX for the whole run */
+    LOCKMODE_WRITE,                         /* -L, LOCK_EX around each write */
+    LOCKMODES
+};
+
+struct writer_config {
+    const char *filename;
+    int interval;
+    int excl_lock;
+    int iterations;
+    int failmax;
+    int blocksize;
+    int writers;
+    int chunks;
+    int flush_ms;
+    long window;
+    enum workload workload;
+    enum durability durability;
+    enum payload payload;
+    const char *live_name;
+    const char *control_path;
+    const char *trace_path;
+    int dashboard;
+    int energy;
+    const char *engine_spec;
+    const char *overlay_spec;
+    int checkpoint_secs;
+    int resume;
+    int flight_window;
+    int flight_after;
+    int adapt_threshold_ms;
+    int adapt_burst_ms;
+    int quiet;
+    enum engine engine;
+    enum lock_mode lock_mode;
+};
+
+/* log-linear latency histogram, microsecond resolution */
+struct lat_hist {
+    unsigned long count;
+    double sum;
+    double min;
+    double max;
+    unsigned long bucket[HIST_BUCKETS];
+};
+
+
+int live_monitor(const char *name, int interval, int count);
+int loopbench(int iterations);
+int compare_targets(const char *spec_a, const char *spec_b, int pairs, int interval, int random, int quiet);
+int report_trace(const char *trace, const char *output, int window);
+int daemon_probe(const char *config, int max_iter, int nworkers, const char *metrics_file, int export_interval);
+int line_writer(const struct writer_config *cfg);
+int publish_writer(const struct writer_config *cfg);
+int append_writer(const struct writer_config *cfg);
+int cores_writer(const struct writer_config *cfg);
+int copyup_writer(const struct writer_config *cfg);
+int automount_writer(const struct writer_config *cfg);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+    timedwriter.h : in-process storage probe
+
+    Copyright (C) 2022 Brendon Caligari <caligari@cypraea.co.uk>
+
+    License: GNU Affero General Public License
+        https://www.gnu.org/licenses/agpl-3.0.en.html
+
+    The line workload of timed-writer as a library, for services that
+    probe their own storage at startup and periodically:
+
+        struct tw_config cfg;
+        struct tw_probe *probe;
+        struct tw_stats stats;
+
+        tw_config_init(&cfg);
+        cfg.filename = "/srv/data/.probe";
+        cfg.interval = 0;
+        probe = tw_probe_create(&cfg);
+        tw_probe_run(probe, 10);
+        tw_probe_snapshot(probe, &stats);
+        tw_probe_destroy(probe);
+
+    struct tw_config and struct tw_stats are allocated by the caller and
+    carry no size, so any change to either bumps both TW_API_VERSION and
+    the library's SOVERSION; check tw_api_version() against
+    TW_API_VERSION when loading the shared library.  Functions return 0
+    or -1 with errno set and never exit(); failed writes are also logged
+    on stderr, as the CLI does.
+
+    The second half is the engine plugin ABI: a shared object exporting
+    tw_engine_entry() can stand in for write() in line runs (-E), so a
+    custom client is timed by the same loop, stats and reports.
+*/
+
+#ifndef TIMEDWRITER_H
+#define TIMEDWRITER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TW_API_VERSION      1
+
+#if defined(__GNUC__)
+#define TW_API              __attribute__((visibility("default")))
+#else
+#define TW_API
+#endif
+
+enum tw_durability {
+    TW_DURABILITY_OSYNC = 0,                /* O_SYNC, every write reaches stable storage */
+    TW_DURABILITY_NONE                      /* page cache only */
+};
+
+struct tw_config {
+    const char *filename;                   /* truncated on create */
+    double interval;                        /* seconds between writes, 0: back to back */
+    int iterations;                         /* for tw_probe_start(), 0: until stopped */
+    int blocksize;                          /* 0: each write is the sequence's "%d\n" */
+    int lock;                               /* hold LOCK_EX on filename while the probe exists */
+    enum tw_durability durability;
+};
+
+/* since create or the last reset, latencies in seconds */
+struct tw_stats {
+    unsigned long writes;
+    unsigned long failures;                 /* failed or short writes */
+    unsigned long long bytes;
+    int last_errno;                         /* EIO for a short write */
+    double min;
+    double avg;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+struct tw_probe;
+
+TW_API int tw_api_version(void);
+TW_API void tw_config_init(struct tw_config *cfg);
+
+/* open filename and take the lock; NULL on failure */
+TW_API struct tw_probe *tw_probe_create(const struct tw_config *cfg);
+
+/* write iterations blocks in the calling thread */
+TW_API int tw_probe_run(struct tw_probe *probe, int iterations);
+
+/* keep writing in a thread of the probe's own until done or tw_probe_stop() */
+TW_API int tw_probe_start(struct tw_probe *probe);
+TW_API int tw_probe_stop(struct tw_probe *probe);
+
+/* consistent copy of the stats, safe while a background run is going */
+TW_API void tw_probe_snapshot(struct tw_probe *probe, struct tw_stats *stats);
+TW_API void tw_probe_reset(struct tw_probe *probe);
+
+/* stops a background run, closes the file */
+TW_API void tw_probe_destroy(struct tw_probe *probe);
+
+
+/*
+    Engine plugins.  Build with cc -shared -fPIC and export:
+
+        const struct tw_engine *tw_engine_entry(void);
+
+    returning a static struct tw_engine with abi_version set to
+    TW_ENGINE_ABI_VERSION and size to sizeof(struct tw_engine).  The
+    loader refuses another ABI version.  New members are only ever added
+    at the end and are optional: the loader copies the first size bytes
+    and treats anything past them as absent, so a plugin built against
+    an older header keeps loading.  Every member up to close is
+    required, TW_ENGINE_SIZE_MIN bytes.  Calls
+    come from one thread at a time, and the built-in write engine (-E
+    write) is the reference implementation.
+*/
+#define TW_ENGINE_ABI_VERSION   1
+#define TW_ENGINE_ENTRY     "tw_engine_entry"
+
+#define TW_ENGINE_OSYNC     0x1             /* a write is durable when it completes */
+
+/* one write handed to an engine */
+struct tw_io {
+    const void *buf;
+    unsigned long len;
+    long long offset;
+    void *user;                             /* the caller's, left untouched */
+    long long res;                          /* set by the engine: bytes written or -errno */
+};
+
+struct tw_engine {
+    int abi_version;
+    unsigned int size;
+    const char *name;
+    int max_batch;                          /* most ios in flight, and per submit(), >= 1 */
+
+    /* target is the run's FILENAME, args what followed ':' in -E or NULL */
+    void *(*open)(const char *target, int flags, const char *args);
+
+    /* queue n ios; returns how many were taken, from the front, or -1 */
+    int (*submit)(void *ctx, struct tw_io **ios, int n);
+
+    /* wait for at least min completions and return up to max of them in done, or -1 */
+    int (*reap)(void *ctx, struct tw_io **done, int min, int max);
+
+    /* make completed writes durable */
+    int (*flush)(void *ctx);
+
+    int (*close)(void *ctx);
+};
+
+#define TW_ENGINE_SIZE_MIN  (offsetof(struct tw_engine, close) + sizeof(int (*)(void *)))
+
+typedef const struct tw_engine *(*tw_engine_entry_fn)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif